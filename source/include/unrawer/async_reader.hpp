@@ -0,0 +1,85 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef _UNRAWER_ASYNC_READER_HPP
+#define _UNRAWER_ASYNC_READER_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct ProcessingParams;
+
+// Reads whole files into memory with io_uring, without blocking pool workers on disk latency.
+// Up to `window` files are in flight in the kernel at once, further requests wait in a queue of bounded length. Files
+// are only opened and their buffers allocated once they enter the window, a long queue costs neither descriptors nor
+// memory. A single completion thread drives the ring and reports every file through the completion callback, with
+// the contents stored in ProcessingParams::raw_buffer on success.
+// Only available on Linux builds with liburing (UNRAWER_WITH_IOURING), start() fails everywhere else and callers
+// keep reading synchronously.
+class AsyncReader {
+public:
+  using Completion = std::function<void(std::shared_ptr<ProcessingParams> &processing, bool ok)>;
+
+  AsyncReader(size_t window, Completion completion);
+  ~AsyncReader(); // waits for the files in flight
+
+  AsyncReader(const AsyncReader &) = delete;
+  AsyncReader &operator=(const AsyncReader &) = delete;
+
+  bool start(); // false when io_uring is not available
+  bool running() const { return started; }
+
+  // Non-blocking. false when the queue is full or the reader stopped, the completion is not called then and the
+  // caller reads the file itself.
+  bool read(std::shared_ptr<ProcessingParams> processing);
+
+private:
+  struct Request {
+    std::shared_ptr<ProcessingParams> processing;
+    std::shared_ptr<std::vector<char>> buffer;
+    int fd = -1;
+    size_t offset = 0;
+  };
+
+  void loop();
+  bool prepare(Request &request); // opens the file and allocates its buffer
+  void complete(Request *request, bool ok);
+
+  const size_t window;
+  const size_t backlog; // requests queued beyond the window
+  Completion completion;
+  bool started = false;
+
+  std::mutex mtx;
+  std::deque<std::unique_ptr<Request>> pending; // waiting for a slot in the window, not opened yet
+  bool stop = false;
+
+  // Buffers of reads the kernel never completed, kept alive as it may still write to them
+  std::vector<std::shared_ptr<std::vector<char>>> abandoned;
+
+  std::thread thread;
+  struct Ring;
+  std::unique_ptr<Ring> ring;
+};
+
+#endif // !_UNRAWER_ASYNC_READER_HPP
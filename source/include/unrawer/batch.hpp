@@ -0,0 +1,106 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+#ifndef _UNRAWER_BATCH_HPP
+#define _UNRAWER_BATCH_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <string>
+#include <utility>
+#include <vector>
+
+class BatchJournal;
+
+// Totals of one stage over the batch
+struct BatchStage {
+  std::string name;
+  size_t files;   // files that ran the stage
+  size_t failed;  // files the stage failed
+  double busySec; // execution time of the stage summed over all files
+};
+
+struct BatchSummary {
+  size_t files = 0;           // raw files submitted
+  size_t written = 0;         // files that reached the end of the graph
+  size_t failed = 0;          // files that failed at any stage
+  size_t skipped = 0;         // files whose output was already up to date
+  size_t resumed = 0;         // files the journal lists as done by an interrupted run, not submitted
+  size_t inputBytes = 0;      // size of the submitted raw files
+  size_t bytesCopied = 0;     // pixel bytes deep-copied between stages and for the writer
+  size_t memoryHighWater = 0; // peak bytes reserved by files in flight
+  size_t workers = 0;         // scheduler worker threads
+  double seconds = 0.0;       // wall time, scan included
+  std::string mode;           // "staged" or "fused"
+
+  std::vector<BatchStage> stages; // stages that ran at least once, in pipeline order
+};
+
+// Snapshot of a running batch
+struct BatchProgress {
+  size_t files = 0;      // raw files submitted so far, still growing while scanning
+  size_t written = 0;    // files written
+  size_t failed = 0;     // files that failed
+  size_t skipped = 0;    // files already up to date
+  bool scanning = true;  // directories are still being listed or watched
+  float fraction = 0.0f; // [0, 1] over the files submitted so far
+};
+
+// Callbacks of a running batch, any of them may be empty.
+// progress runs on a helper thread about four times a second and once more when the batch ends. fileDone runs on
+// the worker that finished the file, concurrently for different files, and should return quickly.
+struct BatchObserver {
+  std::function<void(const BatchProgress &progress)> progress;
+  std::function<void(const std::string &srcFile, bool ok)> fileDone;
+};
+
+struct BatchOptions {
+  size_t workers = 0;              // scheduler worker threads, 0 sizes the pool from ThredsMult
+  BatchJournal *journal = nullptr; // opened journal, files it lists as done are left out and finished ones recorded
+};
+
+// Runs every raw file in `paths` through the stage pipeline with the current settings, directories are scanned
+// recursively. Returns once every file is written or failed.
+// Batches share the global settings and caches and run one at a time, a batch started while another one runs
+// waits for it to end.
+BatchSummary runBatch(const std::vector<std::string> &paths,
+                      const BatchObserver &observer,
+                      const BatchOptions &options = {});
+
+// Same as runBatch on a thread of its own, the future holds the summary once the batch ends
+std::future<BatchSummary> submitBatch(std::vector<std::string> paths,
+                                      BatchObserver observer,
+                                      BatchOptions options = {});
+
+// Watches the `folders` trees and processes every raw file that lands there once it has not changed for `settle`,
+// until `stop` is set. Files already in the folders are left alone. Returns false when the folders cannot be
+// watched, inotify is Linux only. The summary covers every file that arrived. Other batches wait until it stops.
+std::pair<bool, BatchSummary> watchFolders(const std::vector<std::string> &folders,
+                                           const BatchObserver &observer,
+                                           const std::atomic<bool> &stop,
+                                           std::chrono::milliseconds settle = std::chrono::seconds(2),
+                                           const BatchOptions &options = {});
+
+// Drops the OCIO config, compiled processors and parsed LUTs kept between batches, the next batch rebuilds them
+void clearColorCaches();
+
+#endif // !_UNRAWER_BATCH_HPP
@@ -0,0 +1,102 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef _UNRAWER_BUFFER_POOL_HPP
+#define _UNRAWER_BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <vector>
+
+class BufferPool;
+
+// Pixel memory leased from a BufferPool, handed back when the lease is reset or destroyed
+class PooledBuffer {
+public:
+  PooledBuffer() = default;
+  ~PooledBuffer() { reset(); }
+
+  PooledBuffer(PooledBuffer &&other) noexcept;
+  PooledBuffer &operator=(PooledBuffer &&other) noexcept;
+  PooledBuffer(const PooledBuffer &) = delete;
+  PooledBuffer &operator=(const PooledBuffer &) = delete;
+
+  void reset();
+
+  void *data() const { return ptr; }
+  size_t size() const { return len; } // requested size, the block behind it may be larger
+  explicit operator bool() const { return ptr != nullptr; }
+
+private:
+  friend class BufferPool;
+  PooledBuffer(BufferPool *pool, void *ptr, size_t len, size_t block) : pool(pool), ptr(ptr), len(len), block(block) {}
+
+  BufferPool *pool = nullptr;
+  void *ptr = nullptr;
+  size_t len = 0;
+  size_t block = 0;
+};
+
+// Recycles large pixel buffers across the files of a batch.
+// Requests are rounded up to 2 MB size classes and served from the smallest cached block that is at most 1/8
+// larger, so the frames of a shoot keep reusing the same blocks instead of fragmenting the heap. Blocks come straight
+// from the OS (mmap / VirtualAlloc), optionally backed by huge pages, which also cuts TLB misses on 100+ MB images.
+// Free blocks are kept up to `cacheLimit` bytes, the rest go back to the OS. A cacheLimit of 0 disables caching.
+// Must outlive every lease it handed out.
+class BufferPool {
+public:
+  struct Stats {
+    size_t hits;      // requests served from the cache
+    size_t misses;    // requests that mapped a new block
+    size_t inUse;     // bytes leased out
+    size_t cached;    // bytes kept for reuse
+    size_t highWater; // peak of leased + cached bytes
+  };
+
+  explicit BufferPool(size_t cacheLimit, bool hugePages = false);
+  ~BufferPool();
+
+  BufferPool(const BufferPool &) = delete;
+  BufferPool &operator=(const BufferPool &) = delete;
+
+  PooledBuffer acquire(size_t bytes); // empty lease when the OS is out of memory
+
+  Stats stats() const;
+  void report() const;
+
+private:
+  friend class PooledBuffer;
+
+  void give(void *ptr, size_t block);
+  void *map(size_t block);
+  void unmap(void *ptr, size_t block);
+
+  const size_t cacheLimit;
+  const bool hugePages;
+
+  mutable std::mutex mtx;
+  std::map<size_t, std::vector<void *>> free; // block size -> cached blocks
+  size_t hits = 0;
+  size_t misses = 0;
+  size_t inUse = 0;
+  size_t cached = 0;
+  size_t peak = 0;
+};
+
+#endif // !_UNRAWER_BUFFER_POOL_HPP
@@ -0,0 +1,52 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef _UNRAWER_COLOR_CACHE_HPP
+#define _UNRAWER_COLOR_CACHE_HPP
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+#include <OpenImageIO/color.h>
+
+// OCIO config and compiled processors kept for the whole session, so batches after the first and every file after
+// the first of a batch skip the OCIO setup. Processors are keyed by (config, transform, direction), OIIO runs them
+// on float scanlines whatever the pixel type of the image. clear() drops everything after the settings change.
+class ColorCache {
+public:
+  // Loaded on first use and whenever the path changes, empty path - $OCIO
+  std::shared_ptr<OIIO::ColorConfig> config(const std::string &path);
+
+  // File transform (LUT) from the config loaded for `path`, nullptr when OCIO cannot build it
+  OIIO::ColorProcessorHandle fileTransform(const std::string &path, const std::string &name, bool inverse = false);
+
+  void clear();
+
+private:
+  std::shared_ptr<OIIO::ColorConfig> configLocked(const std::string &path);
+
+  std::mutex mtx;
+  std::string configPath;
+  std::shared_ptr<OIIO::ColorConfig> colorConfig;
+  std::map<std::tuple<std::string, std::string, bool>, OIIO::ColorProcessorHandle> processors;
+};
+
+#endif // !_UNRAWER_COLOR_CACHE_HPP
@@ -0,0 +1,60 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef _UNRAWER_DIR_WALKER_HPP
+#define _UNRAWER_DIR_WALKER_HPP
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include "unrawer/threadpool.hpp"
+
+// Parallel recursive directory scan.
+// Every directory is listed by its own pool task, so slow network file systems are queried with several requests
+// in flight. Files are reported through the visitor as soon as they are listed, from the walker threads.
+// Symlinked directories are followed, each real directory is visited once.
+class DirWalker {
+public:
+  using Visitor = std::function<void(const std::string &file)>;
+
+  DirWalker(size_t threads, Visitor visitor);
+
+  void walk(const std::string &dir); // non-blocking
+  void wait();                       // until every directory reachable from the roots is listed
+
+  size_t files() const { return files_found; }
+  size_t dirs() const { return dirs_listed; }
+
+private:
+  void scan(const std::string &dir);
+  bool firstVisit(const std::string &dir);
+
+  Visitor visitor;
+  std::atomic<size_t> files_found{0};
+  std::atomic<size_t> dirs_listed{0};
+
+  std::mutex visited_mutex;
+  std::set<std::string> visited; // canonical paths, protects against symlink loops
+
+  ThreadPool pool; // last, so its threads stop before the state they use goes away
+};
+
+#endif // !_UNRAWER_DIR_WALKER_HPP
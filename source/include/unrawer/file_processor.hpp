@@ -19,19 +19,31 @@
 #ifndef _UNRAWER_FILE_PROCESSOR_HPP
 #define _UNRAWER_FILE_PROCESSOR_HPP
 
-#include <QtCore/QDir>
-#include <QtCore/QRegularExpression>
 #include <algorithm>
 #include <cctype>
+#include <filesystem>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <regex>
 #include <string>
+#include <tuple>
+#include <unordered_map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
+#include "unrawer/async_reader.hpp"
+#include "unrawer/buffer_pool.hpp"
+#include "unrawer/color_cache.hpp"
 #include "unrawer/imageio.hpp"
+#include "unrawer/libraw_pool.hpp"
 #include "unrawer/log.hpp"
+#include "unrawer/lut3d.hpp"
+#include "unrawer/manifest.hpp"
+#include "unrawer/mapped_file.hpp"
 #include "unrawer/settings.hpp"
 #include "unrawer/threadpool.hpp"
-#include "unrawer/ui.hpp"
 
 class OutPaths {
 public:
@@ -94,7 +106,8 @@ enum class ProcessingStatus {
   Graded,
   Unsharped,
   Written,
-  Failed
+  Failed,
+  Skipped
 };
 
 struct ProcessingParams {
@@ -102,6 +115,7 @@ struct ProcessingParams {
   std::shared_ptr<OIIO::ImageBuf> image;
   // File paths:
   std::string srcFile; // Source file full path name
+  size_t srcSize = 0;  // Source file size in bytes
   int outPathIdx;      // Index of the output path in the vector of output paths
   std::string outFile; // Output file name without extension
   std::string outExt;  // Output file name extension
@@ -109,7 +123,11 @@ struct ProcessingParams {
 
   // LibRaw raw_data;
   std::shared_ptr<LibRaw> raw_data;
-  libraw_processed_image_t *raw_image;
+  libraw_processed_image_t *raw_image = nullptr;
+  PooledBuffer raw_image_mem;                    // pooled block behind raw_image, empty when LibRaw allocated it
+  std::vector<PooledBuffer> buffers;             // pooled pixel memory the file's ImageBufs wrap
+  std::shared_ptr<std::vector<char>> raw_buffer; // file contents for the buffered reader
+  std::shared_ptr<MappedFile> raw_map;           // mapped source file LibRaw reads from
   // source settings:
   std::shared_ptr<OIIO::ImageSpec> srcSpec;
 
@@ -123,6 +141,7 @@ struct ProcessingParams {
 
   // Processing params:
   std::string lut_preset;
+  uint64_t fingerprint = 0; // settings the output is made with, recorded in the manifest
 
   // Filters:
   struct sharpening {
@@ -140,10 +159,25 @@ struct ProcessingParams {
   ProcessingStatus status = ProcessingStatus::NotStarted;
   // TODO: maybe add mutex for raw clear status
   bool rawCleared = false;
+  int steps = 0;          // pipeline stages run for this file
+  size_t reserved = 0;    // bytes held in the memory budget
+  size_t bytesCopied = 0; // pixel bytes deep-copied between stages and into the writer's format conversion
 
   // internal
   std::mutex statusMutex;
 
+  // Frees the dcraw memory image once, whoever allocated it
+  void clearRawImage() {
+    if (raw_image && !rawCleared) {
+      if (raw_image_mem) {
+        raw_image_mem.reset();
+      } else {
+        LibRaw::dcraw_clear_mem(raw_image);
+      }
+      rawCleared = true;
+    }
+  }
+
   void setStatus(ProcessingStatus newStatus) {
     std::lock_guard<std::mutex> lock(statusMutex);
     status = newStatus;
@@ -157,21 +191,33 @@ struct ProcessingParams {
 
 struct ProcessGlobals {
   std::shared_ptr<OIIO::ColorConfig> ocio_conf_ptr; // per session color config load
+  ColorCache color_cache;                           // OCIO config and processors kept across batches
+  AsyncReader *async_reader = nullptr;              // io_uring reader of the running batch, nullptr for sync reads
+  LibRawPool *libraw_pool = nullptr;                // processors recycled between files of the running batch
+  BufferPool *buffer_pool = nullptr;                // image buffers recycled between files, nullptr for heap buffers
+  LutCache lut_cache;                               // .cube presets parsed once per session
+  OutputManifest manifest;                          // outputs written per output folder, for up to date checks
 };
 
 extern ProcessGlobals procGlobals;
 
 std::string toLower(const std::string &str);
 
-void getWritableExt(QString *ext, Settings *settings);
+void getWritableExt(std::string *ext, Settings *settings);
+
+std::string getExtension(std::string &extension, Settings *settings);
 
-QString getExtension(QString &extension, Settings *settings);
+std::tuple<std::string, std::string, std::string, std::string> splitPath(const std::string &fileName);
 
-std::tuple<QString, QString, QString, QString> splitPath(const QString &fileName);
+std::optional<std::string> getPresetfromName(const std::string &fileName, Settings *settings);
 
-std::optional<std::string> getPresetfromName(const QString &fileName, Settings *settings);
+std::tuple<std::string, std::string, std::string> getOutName(std::string &path,
+                                                             std::string &baseName,
+                                                             std::string &extension,
+                                                             std::string &prest_sfx,
+                                                             Settings *settings);
 
-std::tuple<QString, QString, QString>
-getOutName(QString &path, QString &baseName, QString &extension, QString &prest_sfx, Settings *settings);
+// Target of a symlink, relative targets taken against the link's folder. Other paths are returned unchanged.
+std::string resolveSymlink(const std::string &fileName);
 
 #endif // !_UNRAWER_FILE_PROCESSOR_HPP
@@ -0,0 +1,76 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+#ifndef _UNRAWER_FOLDER_WATCHER_HPP
+#define _UNRAWER_FOLDER_WATCHER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+// Recursive inotify watch of folder trees that reports files once they are complete.
+// A file becomes a candidate when a writer closes it or it is moved in, and is reported after it has seen no further
+// writes for `settle` and its size stopped changing, so copies that reopen or append are not picked up half done.
+// Folders created or moved into a watched tree are watched as well, files already inside them are candidates.
+// Only available on Linux, start() fails everywhere else.
+class FolderWatcher {
+public:
+  using Filter = std::function<bool(const std::string &file)>; // files worth waiting for
+  using Arrival = std::function<void(const std::string &file)>;
+
+  FolderWatcher(std::chrono::milliseconds settle, Filter wanted, Arrival arrival);
+  ~FolderWatcher();
+
+  FolderWatcher(const FolderWatcher &) = delete;
+  FolderWatcher &operator=(const FolderWatcher &) = delete;
+
+  bool start();                            // false when inotify is not available
+  bool add(const std::string &folder);     // watches the tree, files already there are not reported
+  void run(const std::atomic<bool> &stop); // reports arrivals on the calling thread until `stop` is set
+
+  size_t folders() const { return dirs.size(); }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Pending {
+    Clock::time_point deadline;
+    uintmax_t size;
+  };
+
+  bool watchTree(const std::string &root, bool queueFiles);
+  bool watchDir(const std::string &dir);
+  void track(const std::string &file);
+  void readEvents();
+  void release();
+  int timeout() const; // ms until the next deadline, capped so `stop` is checked regularly
+
+  const std::chrono::milliseconds settle;
+  Filter wanted;
+  Arrival arrival;
+
+  int fd = -1;
+  std::unordered_map<int, std::string> dirs;        // watch descriptor to folder path
+  std::unordered_map<std::string, Pending> pending; // candidates waiting to settle
+};
+
+#endif // !_UNRAWER_FOLDER_WATCHER_HPP
@@ -22,10 +22,11 @@
 #include <iomanip>
 #include <iostream>
 #include <math.h>
+#include <memory>
 #include <string>
+#include <utility>
 
 #include "unrawer/timer.hpp"
-#include "unrawer/ui.hpp"
 
 #include <Imath/half.h>
 #include <OpenImageIO/half.h>
@@ -38,28 +39,31 @@
 
 using namespace OIIO;
 
-// void pbar_color_rand(QProgressBar* progressBar);
-void pbar_color_rand(MainWindow *mainWindow);
-bool m_progress_callback(void *opaque_data, float portion_done);
-
 TypeDesc getTypeDesc(int bit_depth);
 std::string formatText(TypeDesc format);
 void formatFromBuff(ImageBuf &buf);
 
-// bool img_load(ImageBuf& outBuf, const std::string& inputFileName, QProgressBar* progressBar, MainWindow* mainWindow);
-std::pair<bool, std::pair<std::shared_ptr<ImageBuf>, TypeDesc>>
-img_load(const std::string &inputFileName, QProgressBar *progressBar, MainWindow *mainWindow);
+std::pair<bool, std::pair<std::shared_ptr<ImageBuf>, TypeDesc>> img_load(const std::string &inputFileName);
 
+// `bytesCopied`, when given, is increased by the size of the format conversion copy made for the writer
 bool img_write(std::shared_ptr<ImageBuf> out_buf,
                const std::string &outputFileName,
                TypeDesc out_format,
                TypeDesc orig_format,
-               QProgressBar *progressBar,
-               MainWindow *mainWindow);
+               size_t *bytesCopied = nullptr);
 
 bool makePath(const std::string &out_path);
 
-bool thumb_load(ImageBuf &outBuf, const std::string inputFileName, MainWindow *mainWindow);
+// Outputs are written under a hidden partial name next to the final file, with the same extension so the writer
+// picks the same format, and renamed into place once complete. An interrupted batch never leaves a truncated file
+// under the final name.
+std::string partialPath(const std::string &path);
+bool commitOutput(const std::string &partial, const std::string &path); // synced to disk, then renamed
+void discardOutput(const std::string &partial);
+// Removes partial files that processes of this host which are no longer running left in `dir`
+void sweepPartials(const std::string &dir);
+
+bool thumb_load(ImageBuf &outBuf, const std::string inputFileName);
 
 void debugImageBufWrite(const ImageBuf &buf, const std::string &filename);
 
@@ -0,0 +1,57 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+#ifndef _UNRAWER_JOURNAL_HPP
+#define _UNRAWER_JOURNAL_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+// Append-only log of the files a batch has finished, so an interrupted batch can resume where it stopped.
+// Every finished file is appended as one flushed line, a crash loses at most the lines of files still in flight
+// and those are simply processed again. A resumed journal skips the files it lists as done, failed files are
+// retried. The journal remembers the settings it was started with, resuming with other settings starts over.
+class BatchJournal {
+public:
+  BatchJournal() = default;
+
+  BatchJournal(const BatchJournal &) = delete;
+  BatchJournal &operator=(const BatchJournal &) = delete;
+
+  // `resume` keeps the files an earlier run completed, otherwise the journal is truncated. false if it cannot be
+  // written.
+  bool open(const std::string &path, bool resume);
+
+  bool completed(const std::string &srcFile) const; // done in an earlier run
+  size_t resumable() const { return done.size(); }
+
+  void record(const std::string &srcFile, bool ok); // thread safe
+
+private:
+  static std::string key(const std::string &srcFile);
+
+  std::unordered_set<std::string> done;
+  std::mutex mtx;
+  std::ofstream out;
+};
+
+#endif // !_UNRAWER_JOURNAL_HPP
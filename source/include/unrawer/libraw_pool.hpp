@@ -0,0 +1,64 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef _UNRAWER_LIBRAW_POOL_HPP
+#define _UNRAWER_LIBRAW_POOL_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <libraw/libraw.h>
+
+// Reusable LibRaw processors. A LibRaw object is several hundred KB and faults in fresh pages on every allocation, so
+// instead of one per file, processors are recycle()d when their last reference goes and parked for the next file.
+// Each scheduler worker has its own slot: a file usually finishes on the worker that read it, and that worker takes
+// the same processor back for its next file. Idle slots are raided before a new processor is created.
+// Must outlive every processor it handed out.
+class LibRawPool {
+public:
+  // `slots` is the number of scheduler workers, threads outside the workers share the last slot
+  explicit LibRawPool(size_t slots, size_t perSlot = 2);
+  ~LibRawPool();
+
+  LibRawPool(const LibRawPool &) = delete;
+  LibRawPool &operator=(const LibRawPool &) = delete;
+
+  std::shared_ptr<LibRaw> acquire();
+
+  size_t created() const { return made; }
+  size_t reused() const { return hits; }
+
+private:
+  struct Slot {
+    std::mutex mtx;
+    std::vector<LibRaw *> free;
+  };
+
+  Slot &slotOf(size_t worker);
+  void release(LibRaw *raw);
+
+  const size_t perSlot;
+  std::vector<std::unique_ptr<Slot>> slots;
+  std::atomic<size_t> made{0};
+  std::atomic<size_t> hits{0};
+};
+
+#endif // !_UNRAWER_LIBRAW_POOL_HPP
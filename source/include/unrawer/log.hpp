@@ -19,12 +19,14 @@
 #ifndef _UNRAWER_LOG_HPP
 #define _UNRAWER_LOG_HPP
 
+#include <iostream>
+
 #include <boost/log/core.hpp>
 #include <boost/log/trivial.hpp>
 
 #define LOG(x) BOOST_LOG_TRIVIAL(x)
 
-void Log_Init();
+void Log_Init(std::ostream &stream = std::cout); // console sink, the stream must outlive logging
 void Log_SetVerbosity(int l);
 
 #endif // !_UNRAWER_LOG_HPP
@@ -0,0 +1,77 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef _UNRAWER_LUT3D_HPP
+#define _UNRAWER_LUT3D_HPP
+
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <OpenImageIO/imagebuf.h>
+
+// 3D LUT from a .cube file, applied with tetrahedral interpolation.
+// The table is packed 4 floats per grid point (RGB + pad, red fastest) so a vertex is one 128-bit load, and AVX2
+// gathers 8 pixels at once. Rows are spread over the workers with parallelRows().
+class Lut3D {
+public:
+  // nullptr for anything but a plain 3D .cube, 1D and shaper LUTs are left to OCIO
+  static std::shared_ptr<const Lut3D> load(const std::string &path);
+
+  // `dst` may be `src` or uninitialized, it is then allocated with the spec of `src`. false when the pixels are not
+  // in memory, not uint16 or float, or have fewer than 3 channels, nothing is written then.
+  bool apply(OIIO::ImageBuf &dst, const OIIO::ImageBuf &src) const;
+
+  // In place on `count` interleaved float pixels of `nchannels` >= 3, for kernels that run the LUT on their own
+  // rows. Channels past RGB are left alone, results are not clamped.
+  void applyFloat(float *pixels, size_t count, int nchannels) const;
+
+  int size() const { return n; }
+
+private:
+  // Grid coordinates in, RGB out, planar
+  void interpolate(float *r, float *g, float *b, size_t count) const;
+  template <class T> void applyRows(const OIIO::ImageBuf &src, OIIO::ImageBuf &dst, int ybegin, int yend) const;
+
+  int n = 0;
+  float domainMin[3] = {0.0f, 0.0f, 0.0f};
+  float domainMax[3] = {1.0f, 1.0f, 1.0f};
+  std::vector<float> table;
+};
+
+// .cube presets parsed once and shared by every worker, re-read when the file changes on disk
+class LutCache {
+public:
+  // nullptr when the preset has to go through OCIO
+  std::shared_ptr<const Lut3D> get(const std::string &path);
+  void clear();
+
+private:
+  struct Entry {
+    std::filesystem::file_time_type mtime;
+    std::shared_ptr<const Lut3D> lut;
+  };
+
+  std::mutex mtx;
+  std::map<std::string, Entry> luts;
+};
+
+#endif // !_UNRAWER_LUT3D_HPP
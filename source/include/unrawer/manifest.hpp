@@ -0,0 +1,83 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+#ifndef _UNRAWER_MANIFEST_HPP
+#define _UNRAWER_MANIFEST_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+struct Settings;
+
+// Record of the outputs written into each output folder, kept in a manifest file next to them.
+// Every output remembers the size, modification time and content hash of its source and a fingerprint of the
+// settings it was made with. A file whose source and settings are unchanged and whose output still exists is up to
+// date and skips the pipeline. Sources with a new modification time but the same size are hashed before rebuilding,
+// so copies and touched files are not converted again. Folders are loaded on first use and appended to as outputs
+// are written, the file is compacted when it has grown to mostly superseded lines.
+class OutputManifest {
+public:
+  static constexpr const char *kFileName = ".unrawer_manifest";
+
+  // `key` names the output in its folder independent of the extension the writer picks, the output base name
+  bool upToDate(const std::string &dir, const std::string &key, const std::string &srcFile, uint64_t settings);
+
+  // `output` is the file name written into `dir`, `srcHash` 0 hashes the source file
+  void record(const std::string &dir,
+              const std::string &key,
+              const std::string &output,
+              const std::string &srcFile,
+              uint64_t settings,
+              uint64_t srcHash = 0);
+
+private:
+  struct Entry {
+    std::string output;
+    uintmax_t size;
+    int64_t mtime;
+    uint64_t hash;
+    uint64_t settings;
+  };
+
+  struct Folder {
+    std::mutex mtx;
+    bool loaded = false;
+    size_t lines = 0; // entry lines in the file, superseded ones included
+    std::unordered_map<std::string, Entry> entries;
+  };
+
+  Folder &folder(const std::string &dir); // created on first use, loaded by the first caller holding its mutex
+  static void load(const std::string &dir, Folder &folder);
+  static void append(const std::string &dir, Folder &folder, const std::string &key, const Entry &entry);
+
+  std::mutex mtx;
+  std::unordered_map<std::string, std::unique_ptr<Folder>> folders;
+};
+
+uint64_t hashBytes(const char *data, size_t size);
+uint64_t hashFile(const std::string &path); // 0 when the file cannot be read
+
+// Hash of everything that changes the pixels or the name of an output, `lutPreset` is the preset of the file
+uint64_t settingsFingerprint(const Settings &settings, const std::string &lutPreset);
+
+#endif // !_UNRAWER_MANIFEST_HPP
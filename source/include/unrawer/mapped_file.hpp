@@ -0,0 +1,51 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef _UNRAWER_MAPPED_FILE_HPP
+#define _UNRAWER_MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file.
+// Pages are served straight from the page cache, nothing is copied into process memory. The mapping is hinted for
+// sequential access and read-ahead of the whole file is requested up front.
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile() { close(); }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool open(const std::string &path); // false for missing, unreadable or empty files
+  void close();
+
+  bool isOpen() const { return ptr != nullptr; }
+  const char *data() const { return ptr; }
+  size_t size() const { return len; }
+
+private:
+  const char *ptr = nullptr;
+  size_t len = 0;
+#ifdef _WIN32
+  void *mapping = nullptr; // HANDLE of the file mapping object
+#endif
+};
+
+#endif // !_UNRAWER_MAPPED_FILE_HPP
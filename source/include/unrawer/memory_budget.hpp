@@ -0,0 +1,101 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef _UNRAWER_MEMORY_BUDGET_HPP
+#define _UNRAWER_MEMORY_BUDGET_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+// Counting semaphore over bytes, limit 0 means unlimited.
+// Only the thread feeding new files blocks in acquire(). Stage workers never block: a file that needs more than it
+// holds asks with tryGrow() and is set aside by the caller when it does not fit, so workers stay free to finish the
+// files that will release memory.
+class MemoryBudget {
+public:
+  explicit MemoryBudget(size_t limit = 0) : limit(limit) {}
+
+  MemoryBudget(const MemoryBudget &) = delete;
+  MemoryBudget &operator=(const MemoryBudget &) = delete;
+
+  // Blocks until `bytes` fit. A request larger than the whole budget is admitted once nothing else is held.
+  void acquire(size_t bytes) {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (limit > 0) {
+      released.wait(lock, [this, bytes] { return used == 0 || used + bytes <= limit; });
+    }
+    used += bytes;
+    peak = std::max(peak, used);
+  }
+
+  // Grows a reservation from `from` to `to` if it fits. `idle` are bytes held by files waiting to grow, when
+  // everything else in use is idle the request is admitted anyway so one of them can make progress.
+  bool tryGrow(size_t from, size_t to, size_t idle) {
+    std::lock_guard<std::mutex> lock(mtx);
+    size_t others = used - std::min(used, from);
+    if (limit > 0 && used + (to - from) > limit && others > idle) {
+      return false;
+    }
+    used += to - from;
+    peak = std::max(peak, used);
+    return true;
+  }
+
+  // Changes a reservation held by an admitted file without waiting, growing may exceed the limit
+  void resize(size_t from, size_t to) {
+    if (to > from) {
+      std::lock_guard<std::mutex> lock(mtx);
+      used += to - from;
+      peak = std::max(peak, used);
+    } else if (to < from) {
+      release(from - to);
+    }
+  }
+
+  void release(size_t bytes) {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      used -= std::min(used, bytes);
+    }
+    released.notify_all();
+  }
+
+  size_t capacity() const { return limit; }
+
+  size_t inUse() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return used;
+  }
+
+  size_t highWater() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return peak;
+  }
+
+private:
+  const size_t limit;
+  size_t used = 0;
+  size_t peak = 0;
+
+  mutable std::mutex mtx;
+  std::condition_variable released;
+};
+
+#endif // !_UNRAWER_MEMORY_BUDGET_HPP
@@ -0,0 +1,52 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+#ifndef _UNRAWER_PARALLEL_HPP
+#define _UNRAWER_PARALLEL_HPP
+
+#include <algorithm>
+#include <cstddef>
+
+#include <OpenImageIO/imagebufalgo_util.h>
+
+#include "unrawer/scheduler.hpp"
+
+// Rows per strip below which splitting further costs more than it saves
+constexpr int kMinStripRows = 32;
+
+// Runs fn(ROI) over horizontal strips of `roi`. From a pipeline stage the strips go to the scheduler, so the
+// workers that are idle while one huge file is processed take part, elsewhere OIIO's thread pool runs them.
+template <class F> void parallelRows(const OIIO::ROI &roi, F &&fn) {
+  Scheduler *pool = Scheduler::current();
+  if (pool == nullptr) {
+    OIIO::ImageBufAlgo::parallel_image(roi, fn);
+    return;
+  }
+  // A few strips per worker, so a worker that joins late still gets a share
+  size_t rows = static_cast<size_t>(std::max(0, roi.yend - roi.ybegin));
+  size_t strips = std::clamp<size_t>(rows / kMinStripRows, 1, pool->size() * 4);
+  pool->parallelFor(strips, [&](size_t i) {
+    OIIO::ROI strip = roi;
+    strip.ybegin = roi.ybegin + static_cast<int>(rows * i / strips);
+    strip.yend = roi.ybegin + static_cast<int>(rows * (i + 1) / strips);
+    fn(strip);
+  });
+}
+
+#endif // !_UNRAWER_PARALLEL_HPP
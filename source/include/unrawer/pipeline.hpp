@@ -0,0 +1,150 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef _UNRAWER_PIPELINE_HPP
+#define _UNRAWER_PIPELINE_HPP
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "unrawer/file_processor.hpp"
+#include "unrawer/memory_budget.hpp"
+#include "unrawer/scheduler.hpp"
+
+enum class FileState { Running, Suspended, Done, Failed, Skipped };
+
+// Staged: every stage is a separate scheduler task, any worker may pick up the next step of a file.
+// Fused: a worker that picks up a file after reading carries it through the compute stages to the writer
+// in one task, the working set stays in one core's caches. Sorting and reading remain separate stages.
+enum class PipelineMode : int { Staged = 0, Fused = 1 };
+
+// Outcome of one stage for one file: an edge to the next stage, a terminal state, or suspended when the file was
+// handed to an asynchronous source that resumes it later. Skipped ends a file whose output is already up to date.
+struct Step {
+  FileState state;
+  Stage next;
+
+  static Step to(Stage next) { return {FileState::Running, next}; }
+  static Step done() { return {FileState::Done, Stage::Count}; }
+  static Step failed() { return {FileState::Failed, Stage::Count}; }
+  static Step suspend() { return {FileState::Suspended, Stage::Count}; }
+  static Step skipped() { return {FileState::Skipped, Stage::Count}; }
+};
+
+using StageFn = Step (*)(std::shared_ptr<ProcessingParams> &processing);
+
+constexpr uint32_t edge(Stage stage) { return 1u << static_cast<int>(stage); }
+
+// A stage of the graph: the function that runs it and the stages it is allowed to hand a file to.
+// Any stage may end a file as Failed or Skipped, only stages without outgoing edges may end it as Done.
+struct StageNode {
+  Stage stage;
+  StageFn fn;
+  uint32_t edges;
+  bool fusable; // runs inline on the previous stage's worker in fused mode
+};
+
+// Files that ran a stage, failures there and the stage's execution time summed over those files
+struct PipelineStageTotals {
+  size_t files;
+  size_t failed;
+  double busySec;
+};
+
+// Declarative stage graph: Sorter -> Reader -> Unpacker -> Demosaic -> Dcraw -> Processor -> Writer
+// Every submitted file walks the graph until it reaches a terminal state, completion and progress are derived
+// from those states instead of hand-maintained counters.
+class Pipeline {
+public:
+  // Called once per file as it reaches Done, Failed or Skipped, on the worker that finished it. ok for all but Failed.
+  using FileCallback = std::function<void(const ProcessingParams &processing, bool ok)>;
+
+  // With a budget, submit() blocks until the estimated footprint of the new file fits
+  explicit Pipeline(Scheduler *scheduler, PipelineMode mode = PipelineMode::Staged, MemoryBudget *budget = nullptr);
+
+  Pipeline(const Pipeline &) = delete;
+  Pipeline &operator=(const Pipeline &) = delete;
+
+  void onFileDone(FileCallback callback) { file_done = std::move(callback); } // before the first submit()
+
+  void submit(const std::string &fileName);
+  void close(); // no more files will be submitted
+  void wait();  // blocks until closed and every file reached a terminal state
+
+  // Continues a file suspended by stage `from` with the outcome of its asynchronous work, from any thread
+  void resume(Stage from, std::shared_ptr<ProcessingParams> processing, Step step);
+
+  bool finished() const;
+  bool isClosed() const { return closed; }
+  float progress() const;
+
+  size_t total() const { return files_total; }
+  size_t written() const { return files_done; }
+  size_t failed() const { return files_failed; }
+  size_t skipped() const { return files_skipped; }
+  size_t bytesCopied() const { return bytes_copied; }
+  PipelineStageTotals stageTotals(Stage stage) const;
+
+  void report(double wallSec) const; // per-stage throughput to the log
+
+private:
+  void schedule(Stage stage, std::shared_ptr<ProcessingParams> processing);
+  void run(Stage stage, std::shared_ptr<ProcessingParams> &processing);
+  Stage advance(Stage from, std::shared_ptr<ProcessingParams> &processing, Step step);
+  void finish(std::shared_ptr<ProcessingParams> &processing, FileState state);
+  bool reserve(std::shared_ptr<ProcessingParams> &processing, Stage stage); // false when the file was parked
+  void unpark();
+
+  Scheduler *scheduler;
+  PipelineMode mode;
+  MemoryBudget *budget;
+  FileCallback file_done;
+
+  std::atomic<bool> closed{false};
+  std::atomic<size_t> files_total{0};
+  std::atomic<size_t> files_done{0};
+  std::atomic<size_t> files_failed{0};
+  std::atomic<size_t> files_skipped{0};
+  std::atomic<size_t> steps_done{0};   // stage steps taken or skipped, kStageCount per finished file
+  std::atomic<size_t> bytes_copied{0}; // pixel bytes deep-copied between stages and for the writer, all files
+
+  std::array<std::atomic<size_t>, kStageCount> stage_files;
+  std::array<std::atomic<size_t>, kStageCount> stage_failed;
+  std::array<std::atomic<int64_t>, kStageCount> stage_ns;
+
+  // Files whose real size did not fit the budget, rescheduled at the stage they stopped at as memory is released
+  struct Parked {
+    Stage stage;
+    std::shared_ptr<ProcessingParams> processing;
+  };
+  std::mutex park_mutex;
+  std::deque<Parked> parked;
+  size_t parked_bytes = 0; // reservations held by parked files
+
+  mutable std::mutex done_mutex;
+  std::condition_variable done_cv;
+};
+
+#endif // !_UNRAWER_PIPELINE_HPP
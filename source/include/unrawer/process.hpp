@@ -19,10 +19,16 @@
 #ifndef _UNRAWER_PROCESS_HPP
 #define _UNRAWER_PROCESS_HPP
 
+#include "unrawer/batch.hpp"
 #include "unrawer/ui.hpp"
 
 class MainWindow; // forward declaration
 
+// void pbar_color_rand(QProgressBar* progressBar);
+void pbar_color_rand(MainWindow *mainWindow);
+bool m_progress_callback(void *opaque_data, float portion_done);
+
+// Runs a dropped batch, progress and status go to the window
 bool doProcessing(QList<QUrl> URLs, QProgressBar *progressBar, MainWindow *mainWindow);
 
 #endif // !_UNRAWER_PROCESS_HPP
@@ -20,7 +20,7 @@
 #define _UNRAWER_PROCESSORS_HPP
 
 #include "unrawer/file_processor.hpp"
-#include "unrawer/threadpool.hpp"
+#include "unrawer/pipeline.hpp"
 
 #include <OpenImageIO/color.h>
 #include <OpenImageIO/imagebuf.h>
@@ -28,73 +28,39 @@
 #include <OpenImageIO/imageio.h>
 
 #include <condition_variable>
+#include <filesystem>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <mutex>
 #include <thread>
 
-bool isRaw(QString file, const std::unordered_set<std::string> &raw_ext_set);
-
-void Sorter(int index,
-            QString fileName,
-            std::shared_ptr<ProcessingParams> &processing_entry,
-            std::atomic_size_t *fileCntr,
-            std::map<std::string, std::unique_ptr<ThreadPool>> *myPools);
-
-void Reader(int index,
-            std::shared_ptr<ProcessingParams> &processing_entry,
-            std::atomic_size_t *fileCntr,
-            std::map<std::string, std::unique_ptr<ThreadPool>> *myPools);
-
-void oReader(int index,
-             std::shared_ptr<ProcessingParams> &processing_entry,
-             std::atomic_size_t *fileCntr,
-             std::map<std::string, std::unique_ptr<ThreadPool>> *myPools);
-
-void LReader(int index,
-             std::shared_ptr<ProcessingParams> &processing_entry,
-             std::atomic_size_t *fileCntr,
-             std::map<std::string, std::unique_ptr<ThreadPool>> *myPools);
-
-void LUnpacker(int index,
-               std::shared_ptr<ProcessingParams> &processing_entry,
-               std::atomic_size_t *fileCntr,
-               std::map<std::string, std::unique_ptr<ThreadPool>> *myPools);
-
-void Unpacker(int index,
-              std::shared_ptr<ProcessingParams> &processing_entry,
-              std::shared_ptr<std::vector<char>> raw_buffer_ptr,
-              std::atomic_size_t *fileCntr,
-              std::map<std::string, std::unique_ptr<ThreadPool>> *myPools);
-
-void Demosaic(int index,
-              std::shared_ptr<ProcessingParams> &processing_entry,
-              std::atomic_size_t *fileCntr,
-              std::map<std::string, std::unique_ptr<ThreadPool>> *myPools);
-
-void Dcraw(int index,
-           std::shared_ptr<ProcessingParams> &processing_entry,
-           std::atomic_size_t *fileCntr,
-           std::map<std::string, std::unique_ptr<ThreadPool>> *myPools);
-
-void Processor(int index,
-               std::shared_ptr<ProcessingParams> &processing_entry,
-               std::atomic_size_t *fileCntr,
-               std::map<std::string, std::unique_ptr<ThreadPool>> *myPools);
-
-void OProcessor(int index,
-                std::shared_ptr<ProcessingParams> &processing_entry,
-                std::atomic_size_t *fileCntr,
-                std::map<std::string, std::unique_ptr<ThreadPool>> *myPools);
-
-void Writer(int index,
-            std::shared_ptr<ProcessingParams> &processing_entry,
-            std::atomic_size_t *fileCntr,
-            std::map<std::string, std::unique_ptr<ThreadPool>> *myPools);
-
-void Dummy(int index,
-           std::shared_ptr<ProcessingParams> &processing_entry,
-           std::atomic_size_t *fileCntr,
-           std::map<std::string, std::unique_ptr<ThreadPool>> *myPools);
+bool isRaw(const std::string &file, const std::unordered_set<std::string> &raw_ext_set);
+
+Step Sorter(std::shared_ptr<ProcessingParams> &processing);
+
+Step Reader(std::shared_ptr<ProcessingParams> &processing);
+
+Step oReader(std::shared_ptr<ProcessingParams> &processing);
+
+Step LReader(std::shared_ptr<ProcessingParams> &processing);
+
+Step LUnpacker(std::shared_ptr<ProcessingParams> &processing);
+
+Step Unpacker(std::shared_ptr<ProcessingParams> &processing);
+
+Step Demosaic(std::shared_ptr<ProcessingParams> &processing);
+
+Step Dcraw(std::shared_ptr<ProcessingParams> &processing);
+
+Step Processor(std::shared_ptr<ProcessingParams> &processing);
+
+Step OProcessor(std::shared_ptr<ProcessingParams> &processing);
+
+Step Writer(std::shared_ptr<ProcessingParams> &processing);
+
+Step RawDump(std::shared_ptr<ProcessingParams> &processing);
+
+Step Dummy(std::shared_ptr<ProcessingParams> &processing);
 
 #endif // !_UNRAWER_PROCESSORS_HPP
@@ -0,0 +1,38 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef _UNRAWER_RAW_DUMP_HPP
+#define _UNRAWER_RAW_DUMP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Writers for undemosaiced single channel 16-bit sensor data.
+// `pitch` is the distance between rows in bytes, LibRaw pads rows of raw_image (imgdata.sizes.raw_pitch).
+
+// dst[i] = byte-swapped src[i], AVX2/SSE2/NEON with a scalar tail. src and dst may be the same buffer.
+void byteSwap16(const uint16_t *src, uint16_t *dst, size_t count);
+
+// Binary PGM (P5), big-endian samples. Rows are swapped into a per-thread buffer and written in large blocks.
+bool writeRawPGM(const std::string &path, const uint16_t *data, size_t width, size_t height, size_t pitch);
+
+// Uncompressed 16-bit grayscale TIFF through OpenImageIO, written straight from the LibRaw buffer
+bool writeRawTIFF(const std::string &path, const uint16_t *data, size_t width, size_t height, size_t pitch);
+
+#endif // !_UNRAWER_RAW_DUMP_HPP
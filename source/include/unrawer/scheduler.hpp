@@ -0,0 +1,152 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef _UNRAWER_SCHEDULER_HPP
+#define _UNRAWER_SCHEDULER_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "unrawer/task.hpp"
+
+// Processing stages, in pipeline order. Workers prefer later stages, so files that are already in flight are
+// finished before new ones are started.
+enum class Stage : int { Sorter = 0, Reader, Unpacker, Demosaic, Dcraw, Processor, Writer, RawDump, Count };
+
+constexpr size_t kStageCount = static_cast<size_t>(Stage::Count);
+
+const char *stageName(Stage stage);
+
+struct StageStats {
+  size_t queued;    // tasks waiting in the deques
+  size_t running;   // tasks being executed right now
+  size_t completed; // tasks finished since the scheduler was created
+  double busySec;   // accumulated execution time of all finished tasks
+  size_t limit;     // workers allowed to run the stage at once
+};
+
+// Work-stealing executor shared by all pipeline stages.
+// Every worker owns one deque per stage. Tasks submitted from a worker go to its own deques and are popped LIFO,
+// so the follow-up stage of a file usually runs on the same core. Idle workers steal FIFO from the others.
+// Tasks submitted from outside the pool are spread round-robin over the workers.
+// Each stage has a limit on how many workers may run it at once, the optional balancer shifts those limits
+// toward whichever stage is the bottleneck.
+// A stage task can fan its own work out with parallelFor(): workers between tasks help with the chunks before
+// taking new stage work, so a single huge file uses every core.
+class Scheduler {
+public:
+  explicit Scheduler(size_t threads);
+  ~Scheduler();
+
+  Scheduler(const Scheduler &) = delete;
+  Scheduler &operator=(const Scheduler &) = delete;
+
+  // Fire-and-forget, the bound call is stored inline in the Task so hand-offs do not allocate
+  template <class F, class... Args> void post(Stage stage, F &&f, Args &&...args) {
+    push(stage, Task::bind(std::forward<F>(f), std::forward<Args>(args)...));
+  }
+
+  void waitForAllTasks();
+  bool isIdle() const { return inflight == 0; }
+  size_t size() const { return workers.size(); }
+  static size_t currentWorker(); // index of the worker on the calling thread, SIZE_MAX on other threads
+  static Scheduler *current();   // scheduler of the worker on the calling thread, nullptr on other threads
+  StageStats stats(Stage stage) const;
+
+  // Runs fn(i) for every i in [0, n) and returns when all are done. The caller works through the chunks too, idle
+  // workers join in, outside any stage limit. Exceptions thrown by fn are rethrown here after all chunks ran.
+  void parallelFor(size_t n, const std::function<void(size_t)> &fn);
+
+  // Clamped to [1, size()], every stage starts at size()
+  void setStageLimit(Stage stage, size_t limit);
+  size_t stageLimit(Stage stage) const { return stage_limit[static_cast<size_t>(stage)]; }
+
+  // Every `interval` moves one worker from the stage with the most unused limit to the most congested stage that
+  // runs at its limit. Decisions are logged, the settled limits are logged when the scheduler is destroyed.
+  void startBalancer(std::chrono::milliseconds interval);
+
+private:
+  struct WorkerQueues {
+    std::mutex mtx;
+    std::array<std::deque<Task>, kStageCount> tasks;
+    std::atomic<size_t> count{0}; // total tasks over all stages, read without the lock by thieves
+  };
+
+  // One parallelFor() call, chunks are claimed through `next`
+  struct ForJob {
+    const std::function<void(size_t)> *fn; // only touched for claimed chunks, the caller outlives them
+    size_t n;
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+    std::mutex mtx;
+    std::condition_variable finished;
+    std::exception_ptr error;
+  };
+
+  void push(Stage stage, Task task);
+  void runChunks(ForJob &job);
+  bool help(); // runs chunks of an open parallelFor(), false when there is none
+  bool popLocal(size_t self, Task &task, Stage &stage);
+  bool steal(size_t self, Task &task, Stage &stage);
+  bool claim(size_t s); // takes a running slot of stage s if it is under its limit
+  bool runnable() const;
+  void wakeWorker();
+  void execute(Stage stage, Task &task);
+  void workerLoop(size_t self);
+  void balancerLoop(std::chrono::milliseconds interval);
+
+  std::vector<std::unique_ptr<WorkerQueues>> queues; // per worker deques
+  std::vector<std::thread> workers;                  // Worker threads
+
+  std::mutex park_mutex;             // Mutex for parking idle workers
+  std::condition_variable park_cv;   // Condition variable for task availability
+  std::mutex done_mutex;             // Mutex for waitForAllTasks
+  std::condition_variable done_cv;   // Condition variable for completion of all tasks
+  std::atomic<bool> stop{false};     // Atomic flag to stop the workers
+  std::atomic<size_t> queued{0};     // Tasks sitting in any deque
+  std::atomic<size_t> sleeping{0};   // Parked workers
+  std::atomic<size_t> inflight{0};   // Queued + running tasks
+  std::atomic<size_t> next_queue{0}; // Round-robin cursor for external submissions
+
+  std::mutex jobs_mutex;                     // Guards jobs
+  std::deque<std::shared_ptr<ForJob>> jobs; // parallelFor() calls with unclaimed chunks
+  std::atomic<size_t> open_jobs{0};         // jobs.size(), read without the lock
+
+  std::array<std::atomic<size_t>, kStageCount> stage_queued;
+  std::array<std::atomic<size_t>, kStageCount> stage_running;
+  std::array<std::atomic<size_t>, kStageCount> stage_completed;
+  std::array<std::atomic<int64_t>, kStageCount> stage_busy_ns;
+  std::array<std::atomic<size_t>, kStageCount> stage_limit;
+
+  std::thread balancer;
+  std::mutex balancer_mutex;
+  std::condition_variable balancer_cv;
+  bool balancer_stop = false;
+};
+
+#endif // !_UNRAWER_SCHEDULER_HPP
@@ -20,7 +20,7 @@
 #define _UNRAWER_SETTINGS_HPP
 
 #include "unrawer/log.hpp"
-#include "unrawer/ui.hpp"
+#include <map>
 #include <string>
 #include <vector>
 
@@ -43,6 +43,13 @@ struct Settings {
   int dDemosaic;
   float mltThreads;
   uint verbosity;
+  uint pipelineMode;
+  uint memLimit;
+  uint readMode;
+  uint readAhead;
+  uint poolCache;
+  bool hugePages;
+  bool skipUpToDate;
 
   std::vector<std::string> out_formats = {"tif", "exr", "png", "jpg", "jp2", "ppm"};
   std::string ocioConfigPath, dLutPreset;
@@ -113,14 +120,22 @@ struct Settings {
     lutMode = 0;       // LUT mode: -1 - disabled, 0 - Smart, 1 - Force
     dLutPreset = "";   // Default LUT preset, top one
 
-    numThreads = 5;  // Number of threads: 0 - auto, >0 - number of threads
-    rangeMode = 0;   // Float type: 0 - unsigned, 1 - signed, 2 - unsigned -> signed, 3 - signed -> unsigned
-    fileFormat = -1; // File format: -1 - original, 0 - TIFF, 1 - OpenEXR, 2 - PNG, 3 - JPEG, 4 - JPEG-2000, 5 - PPM
-    defFormat = 0;   // Default file format = TIFF
+    numThreads = 5;    // Number of threads: 0 - auto, >0 - number of threads
+    pipelineMode = 0;  // Pipeline mode: 0 - staged, 1 - fused
+    memLimit = 0;      // Memory limit for images in flight, MB: 0 - unlimited
+    readMode = 1;      // Raw read mode: 0 - LibRaw file I/O, 1 - memory-mapped, 2 - async io_uring
+    readAhead = 8;     // Files read ahead of the unpackers in async read mode
+    poolCache = 1024;  // Image buffers kept for reuse between files, MB: 0 - no pool, heap buffers
+    hugePages = false; // Back pooled image buffers with huge pages
+    rangeMode = 0;     // Float type: 0 - unsigned, 1 - signed, 2 - unsigned -> signed, 3 - signed -> unsigned
+    fileFormat = -1;   // File format: -1 - original, 0 - TIFF, 1 - OpenEXR, 2 - PNG, 3 - JPEG, 4 - JPEG-2000, 5 - PPM
+    defFormat = 0;     // Default file format = TIFF
     bitDepth =
         -1; // Bit depth: -1 - Original, 0 - uint8, 1 - uint16, 2 - uint32, 3 - uint64, 4 - half, 5 - float, 6 - double
     defBDepth = 1; // Default bit depth = uint16
 
+    skipUpToDate = true; // Skip files whose output is recorded in the output folder's manifest and unchanged
+
     rawRot = -1; // Raw rotation: -1 - Auto EXIF, 0 - Unrotated/Horisontal, 3 - 180 Horisontal, 5 - 90 CW Vertical, 6 -
                  // 90 CCW Vertical
     rawSpace = 1;
@@ -148,6 +163,7 @@ struct Settings {
     // rawParms.exp_correc = 1;
     rawParms.half_size = 0;      // Half-size raw image (1=yes). For some formats, it affects RAW data reading.
     rawParms.denoise_thr = 0.0f; // Threshold for wavelet denoising
+    rawParms.fbdd_noiserd = 0;   // FBDD noise reduction off
   }
 
   // get bit depth in bytes
@@ -174,7 +190,8 @@ struct Settings {
 
 extern Settings settings;
 
-bool loadSettings(Settings &settings, const std::string &filename);
+// `overrides` are "Section.Key=value" entries applied on top of the file
+bool loadSettings(Settings &settings, const std::string &filename, const std::vector<std::string> &overrides = {});
 void printSettings(Settings &settings);
 
 #endif // !_UNRAWER_SETTINGS_HPP
@@ -0,0 +1,63 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef _UNRAWER_SIMD_HPP
+#define _UNRAWER_SIMD_HPP
+
+// Instruction set selection shared by the pixel kernels.
+// Builds target baseline x86-64, so AVX2 code is compiled per function (UNRAWER_TARGET_AVX2) and picked at runtime
+// with cpuHasAVX2(). SSE2 is always there on x86-64 and NEON on arm64.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#define UNRAWER_SIMD_X86 1
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define UNRAWER_TARGET_AVX2
+#else
+#define UNRAWER_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define UNRAWER_SIMD_NEON 1
+#endif
+
+#if defined(UNRAWER_SIMD_X86)
+// AVX2 and FMA usable by this process, checked once
+inline bool cpuHasAVX2() {
+  static const bool avx2 = [] {
+#if defined(__AVX2__) && defined(__FMA__)
+    return true;
+#elif defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0, avx = (info[2] & (1 << 28)) != 0, fma = (info[2] & (1 << 12)) != 0;
+    if (!osxsave || !avx || !fma || (_xgetbv(0) & 6) != 6) {
+      return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+  }();
+  return avx2;
+}
+#endif
+
+#endif // !_UNRAWER_SIMD_HPP
@@ -0,0 +1,132 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef _UNRAWER_TASK_HPP
+#define _UNRAWER_TASK_HPP
+
+#include <cstddef>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// Move-only type-erased void() callable.
+// Callables up to kInlineSize bytes (a stage function pointer plus its usual arguments) are stored in place, so
+// submitting them does not touch the heap. Larger callables fall back to a single heap allocation.
+class Task {
+public:
+  static constexpr size_t kInlineSize = 64;
+
+  Task() noexcept = default;
+  Task(std::nullptr_t) noexcept {}
+
+  template <class F,
+            class = std::enable_if_t<!std::is_same<std::decay_t<F>, Task>::value &&
+                                     std::is_invocable<std::decay_t<F> &>::value>>
+  Task(F &&f) {
+    using Fn = std::decay_t<F>;
+    if constexpr (fitsInline<Fn>()) {
+      ::new (static_cast<void *>(storage)) Fn(std::forward<F>(f));
+      ops = &InlineOps<Fn>::table;
+    } else {
+      ::new (static_cast<void *>(storage)) Fn *(new Fn(std::forward<F>(f)));
+      ops = &HeapOps<Fn>::table;
+    }
+  }
+
+  Task(Task &&other) noexcept : ops(other.ops) {
+    if (ops) {
+      ops->relocate(other.storage, storage);
+      other.ops = nullptr;
+    }
+  }
+
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      reset();
+      ops = other.ops;
+      if (ops) {
+        ops->relocate(other.storage, storage);
+        other.ops = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  Task &operator=(std::nullptr_t) noexcept {
+    reset();
+    return *this;
+  }
+
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+
+  ~Task() { reset(); }
+
+  void operator()() { ops->invoke(storage); }
+
+  explicit operator bool() const noexcept { return ops != nullptr; }
+
+  // Binds f to copies of args. Arguments are passed to f as lvalues, the same way std::bind does.
+  template <class F, class... Args> static Task bind(F &&f, Args &&...args) {
+    return Task([fn = std::forward<F>(f), bound = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+      std::apply(fn, bound);
+    });
+  }
+
+private:
+  struct Ops {
+    void (*invoke)(void *self);
+    void (*relocate)(void *from, void *to) noexcept; // move-construct into `to` and destroy `from`
+    void (*destroy)(void *self) noexcept;
+  };
+
+  template <class Fn> static constexpr bool fitsInline() {
+    return sizeof(Fn) <= kInlineSize && alignof(Fn) <= alignof(std::max_align_t) &&
+           std::is_nothrow_move_constructible<Fn>::value;
+  }
+
+  template <class Fn> struct InlineOps {
+    static void invoke(void *self) { (*static_cast<Fn *>(self))(); }
+    static void relocate(void *from, void *to) noexcept {
+      ::new (to) Fn(std::move(*static_cast<Fn *>(from)));
+      static_cast<Fn *>(from)->~Fn();
+    }
+    static void destroy(void *self) noexcept { static_cast<Fn *>(self)->~Fn(); }
+    static constexpr Ops table{&invoke, &relocate, &destroy};
+  };
+
+  template <class Fn> struct HeapOps {
+    static void invoke(void *self) { (**static_cast<Fn **>(self))(); }
+    static void relocate(void *from, void *to) noexcept { ::new (to) Fn *(*static_cast<Fn **>(from)); }
+    static void destroy(void *self) noexcept { delete *static_cast<Fn **>(self); }
+    static constexpr Ops table{&invoke, &relocate, &destroy};
+  };
+
+  void reset() noexcept {
+    if (ops) {
+      ops->destroy(storage);
+      ops = nullptr;
+    }
+  }
+
+  alignas(std::max_align_t) unsigned char storage[kInlineSize];
+  const Ops *ops = nullptr;
+};
+
+#endif // !_UNRAWER_TASK_HPP
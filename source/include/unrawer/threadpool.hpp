@@ -19,10 +19,14 @@
 #ifndef _UNRAWER_THREADPOOL_HPP
 #define _UNRAWER_THREADPOOL_HPP
 
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <future>
+#include <memory>
 #include <mutex>
 #include <optional>
 #include <queue>
@@ -30,6 +34,8 @@
 #include <thread>
 #include <vector>
 
+#include "unrawer/task.hpp"
+
 // template <typename T>
 // class SafeQueue {
 // private:
@@ -126,35 +132,122 @@ public:
   }
 };
 
+// Bounded lock-free multi-producer/multi-consumer ring buffer (D. Vyukov).
+// Every cell carries a sequence number, producers and consumers claim cells with a single CAS on their cursor.
+template <typename T> class MPMCQueue {
+public:
+  explicit MPMCQueue(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask = size - 1;
+    cells = std::make_unique<Cell[]>(size);
+    for (size_t i = 0; i < size; ++i) {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+  }
+
+  MPMCQueue(const MPMCQueue &) = delete;
+  MPMCQueue &operator=(const MPMCQueue &) = delete;
+
+  // item is left untouched when the queue is full
+  bool try_push(T &item) {
+    Cell *cell;
+    size_t pos = tail.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells[pos & mask];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false; // full
+      } else {
+        pos = tail.load(std::memory_order_relaxed);
+      }
+    }
+    cell->data = std::move(item);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool try_pop(T &item) {
+    Cell *cell;
+    size_t pos = head.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells[pos & mask];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false; // empty
+      } else {
+        pos = head.load(std::memory_order_relaxed);
+      }
+    }
+    item = std::move(cell->data);
+    cell->data = T(); // drop captured state now, not when the cell is reused
+    cell->sequence.store(pos + mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  size_t capacity() const { return mask + 1; }
+
+private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T data;
+  };
+
+  std::unique_ptr<Cell[]> cells;
+  size_t mask;
+  alignas(64) std::atomic<size_t> head; // consumer cursor
+  alignas(64) std::atomic<size_t> tail; // producer cursor
+};
+
 class ThreadPool {
 public:
   ThreadPool(size_t threads, size_t maxQueueSize)
-      : stop(false), working(0), maxQueueSize(maxQueueSize), tasks_count(0) {
+      : tasks(maxQueueSize), stop(false), working(0), tasks_count(0), pending(0), idle(0), waiters(0),
+        space_waiters(0), handoff_count(0),
+        maxQueueSize(std::min(maxQueueSize, tasks.capacity())) {
     // Create worker threads
     for (size_t i = 0; i < threads; ++i) {
       workers.emplace_back([this] {
+        int spins = 0;
         for (;;) {
-          std::function<void()> task;
-          {
-            std::unique_lock<std::mutex> lock(this->queue_mutex);
-            // Wait until there is a task or the ThreadPool is stopped
-            this->condition.wait(lock, [this] { return this->stop || !this->tasks.empty(); });
-            if (this->stop && this->tasks.empty()) {
-              return; // Exit the thread when ThreadPool is stopped
-            }
-            task = std::move(this->tasks.front());
-            this->tasks.pop();
+          Task task;
+          if (this->tasks.try_pop(task)) {
+            --this->pending;
+            spins = 0;
             ++this->working;
-          }
-          task(); // Execute the task
-          {
-            std::unique_lock<std::mutex> lock(this->queue_mutex);
+            task(); // Execute the task
+            task = nullptr;
             --this->working;
-            --this->tasks_count;
-            this->done_condition.notify_all();
-            if (this->tasks_count < this->maxQueueSize) {
-              this->queue_full = false;
-            }
+            finishTask();
+            continue;
+          }
+          if (spins < 64) { // Spin briefly before parking, the next task is usually close behind
+            ++spins;
+            std::this_thread::yield();
+            continue;
+          }
+          spins = 0;
+          std::unique_lock<std::mutex> lock(this->park_mutex);
+          ++this->idle;
+          // Wait until there is a task or the ThreadPool is stopped
+          this->condition.wait(lock, [this] { return this->stop || this->pending > 0; });
+          --this->idle;
+          if (this->stop && this->pending <= 0) {
+            return; // Exit the thread when ThreadPool is stopped
           }
         }
       });
@@ -169,46 +262,114 @@ public:
         std::make_shared<std::packaged_task<return_type()>>(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
 
     std::future<return_type> res = task->get_future();
-    {
-      std::unique_lock<std::mutex> lock(queue_mutex);
 
-      if (stop) {
-        throw std::runtime_error("enqueue on stopped ThreadPool");
-      }
+    if (stop) {
+      throw std::runtime_error("enqueue on stopped ThreadPool");
+    }
 
-      while (tasks_count >= maxQueueSize) {
-        // Wait until there is space in the task queue
-        condition.wait_for(lock, std::chrono::milliseconds(100));
-      }
+    if (!tryReserveSlot()) {
+      // Wait until a finishing task frees a slot
+      std::unique_lock<std::mutex> lock(space_mutex);
+      ++space_waiters;
+      space_condition.wait(lock, [this] { return tryReserveSlot(); });
+      --space_waiters;
+    }
 
-      tasks.emplace([task]() { (*task)(); });
-      ++this->tasks_count;
-      if (this->tasks_count >= this->maxQueueSize) {
-        this->queue_full = true;
-      }
+    pushReserved([task]() { (*task)(); });
+    return res;
+  }
+
+  // Non-blocking enqueue, returns std::nullopt when the queue is full
+  template <class F, class... Args>
+  auto try_enqueue(F &&f, Args &&...args) -> std::optional<std::future<typename std::result_of<F(Args...)>::type>> {
+    using return_type = typename std::result_of<F(Args...)>::type;
+
+    if (stop) {
+      throw std::runtime_error("enqueue on stopped ThreadPool");
     }
-    condition.notify_one();
+    if (!tryReserveSlot()) {
+      return std::nullopt;
+    }
+
+    auto task =
+        std::make_shared<std::packaged_task<return_type()>>(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    std::future<return_type> res = task->get_future();
+
+    pushReserved([task]() { (*task)(); });
     return res;
   }
 
-  bool isIdle() {
-    std::unique_lock<std::mutex> lock(queue_mutex);
-    return tasks.empty() && (working == 0);
+  // Never blocks the caller. When the queue is full the task is handed off and admitted by the worker that frees
+  // the next slot, so the upstream worker can go on with its own work.
+  template <class F, class... Args>
+  auto enqueue_async(F &&f, Args &&...args) -> std::future<typename std::result_of<F(Args...)>::type> {
+    using return_type = typename std::result_of<F(Args...)>::type;
+
+    auto task =
+        std::make_shared<std::packaged_task<return_type()>>(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+
+    std::future<return_type> res = task->get_future();
+
+    if (stop) {
+      throw std::runtime_error("enqueue on stopped ThreadPool");
+    }
+
+    if (tryReserveSlot()) {
+      pushReserved([task]() { (*task)(); });
+      return res;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(handoff_mutex);
+      handoff.emplace_back([task]() { (*task)(); });
+    }
+    ++handoff_count;
+    // The slot may have been freed between the failed reservation and the hand-off
+    admitHandoff();
+    return res;
   }
 
+  // Fire-and-forget submission: no packaged_task, no future, and no heap allocation for small callables.
+  // Blocks like enqueue when the queue is full.
+  template <class F, class... Args> void post(F &&f, Args &&...args) {
+    if (stop) {
+      throw std::runtime_error("post on stopped ThreadPool");
+    }
+
+    Task task = Task::bind(std::forward<F>(f), std::forward<Args>(args)...);
+
+    if (!tryReserveSlot()) {
+      std::unique_lock<std::mutex> lock(space_mutex);
+      ++space_waiters;
+      space_condition.wait(lock, [this] { return tryReserveSlot(); });
+      --space_waiters;
+    }
+
+    pushReserved(std::move(task));
+  }
+
+  bool isIdle() { return pending <= 0 && working == 0 && handoff_count == 0; }
+
   void waitForAllTasks() {
-    std::unique_lock<std::mutex> lock(queue_mutex);
-    done_condition.wait(lock, [this] { return tasks_count == 0; });
+    std::unique_lock<std::mutex> lock(done_mutex);
+    ++waiters;
+    done_condition.wait(lock, [this] { return tasks_count == 0 && handoff_count == 0; });
+    --waiters;
   }
 
   void setWritePoolLimitation(size_t limit) {
-    std::unique_lock<std::mutex> lock(queue_mutex);
-    maxQueueSize = limit;
+    maxQueueSize = std::min(limit, tasks.capacity());
+    while (admitHandoff()) {
+    }
+    if (space_waiters > 0) {
+      { std::lock_guard<std::mutex> lock(space_mutex); }
+      space_condition.notify_all();
+    }
   }
 
   ~ThreadPool() {
     {
-      std::unique_lock<std::mutex> lock(queue_mutex);
+      std::unique_lock<std::mutex> lock(park_mutex);
       stop = true;
     }
     condition.notify_all();
@@ -218,16 +379,87 @@ public:
   }
 
 private:
-  std::vector<std::thread> workers;        // Worker threads
-  std::queue<std::function<void()>> tasks; // Task queue
-  std::mutex queue_mutex;                  // Mutex to protect the task queue
-  std::condition_variable condition;       // Condition variable for task availability
-  std::condition_variable done_condition;  // Condition variable for completion of all tasks
-  std::atomic<bool> stop;                  // Atomic flag to stop the ThreadPool
-  std::atomic<int> working;                // Atomic counter for the number of working threads
-  std::atomic<int> tasks_count;            // Atomic counter for the number of tasks in the queue
-  size_t maxQueueSize;                     // Maximum size of the task queue
-  std::atomic<bool> queue_full = false;    // Atomic flag indicating if the task queue is full
+  bool tryReserveSlot() {
+    // The count covers queued and running tasks
+    int count = tasks_count.load();
+    while (count < static_cast<int>(maxQueueSize.load())) {
+      if (tasks_count.compare_exchange_weak(count, count + 1)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void pushReserved(Task task) {
+    while (!tasks.try_push(task)) {
+      std::this_thread::yield(); // slot is reserved, a consumer is just finishing a pop
+    }
+    ++pending;
+    wakeWorker();
+  }
+
+  // Moves one handed-off task into the queue if a slot is free
+  bool admitHandoff() {
+    if (handoff_count == 0 || !tryReserveSlot()) {
+      return false;
+    }
+    Task task;
+    {
+      std::lock_guard<std::mutex> lock(handoff_mutex);
+      if (handoff.empty()) {
+        --tasks_count;
+        return false;
+      }
+      task = std::move(handoff.front());
+      handoff.pop_front();
+    }
+    pushReserved(std::move(task));
+    --handoff_count; // after the slot is taken, so waitForAllTasks never sees both counters at zero too early
+    return true;
+  }
+
+  void wakeWorker() {
+    // Parked workers re-check `pending` under park_mutex, only lock when someone is actually parked
+    if (idle > 0) {
+      { std::lock_guard<std::mutex> lock(park_mutex); }
+      condition.notify_one();
+    }
+  }
+
+  void finishTask() {
+    --tasks_count;
+    if (admitHandoff()) {
+      return; // the freed slot went to a handed-off task
+    }
+    if (space_waiters > 0) {
+      { std::lock_guard<std::mutex> lock(space_mutex); }
+      space_condition.notify_one();
+    }
+    if (tasks_count == 0 && handoff_count == 0 && waiters > 0) {
+      std::lock_guard<std::mutex> lock(done_mutex);
+      done_condition.notify_all();
+    }
+  }
+
+  std::vector<std::thread> workers;                // Worker threads
+  MPMCQueue<Task> tasks;                           // Lock-free task queue
+  std::deque<Task> handoff;                        // Tasks handed off by enqueue_async while the queue was full
+  std::mutex park_mutex;                           // Mutex for parking idle workers
+  std::mutex space_mutex;                          // Mutex for producers waiting for a free slot
+  std::mutex done_mutex;                           // Mutex for waitForAllTasks
+  std::mutex handoff_mutex;                        // Mutex to protect the hand-off list
+  std::condition_variable condition;               // Condition variable for task availability
+  std::condition_variable space_condition;         // Condition variable for free queue slots
+  std::condition_variable done_condition;          // Condition variable for completion of all tasks
+  std::atomic<bool> stop;                          // Atomic flag to stop the ThreadPool
+  std::atomic<int> working;                        // Atomic counter for the number of working threads
+  std::atomic<int> tasks_count;                    // Atomic counter for queued and running tasks
+  std::atomic<int> pending;                        // Atomic counter for tasks waiting in the queue
+  std::atomic<int> idle;                           // Atomic counter for parked workers
+  std::atomic<int> waiters;                        // Atomic counter for threads in waitForAllTasks
+  std::atomic<int> space_waiters;                  // Atomic counter for producers blocked in enqueue
+  std::atomic<int> handoff_count;                  // Atomic counter for handed-off tasks not yet admitted
+  std::atomic<size_t> maxQueueSize;                // Maximum number of queued and running tasks
 };
 
 // class ThreadPool {
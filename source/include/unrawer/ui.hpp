@@ -40,9 +40,7 @@
 #include <QtCore/QRandomGenerator>
 
 #include "unrawer/process.hpp"
-
-#define VERSION_MAJOR 1
-#define VERSION_MINOR 45
+#include "unrawer/version.hpp"
 
 void setPBarColor(QProgressBar *progressBar, const QColor &color = QColor("#05B8CC"));
 
@@ -24,22 +24,15 @@
 #include <OpenImageIO/imageio.h>
 
 #include "unrawer/file_processor.hpp"
-#include "unrawer/ui.hpp"
 using namespace OIIO;
 
-bool unrawer_main(const std::string &inputFileName,
-                  const std::string &outputFileName,
-                  ColorConfig *colorconfig,
-                  std::string *lut_preset,
-                  QProgressBar *progressBar,
-                  MainWindow *mainWindow);
-
 std::pair<bool, std::shared_ptr<ImageBuf>> imgProcessor(ImageBuf &input_buf,
                                                         ColorConfig *colorconfig,
                                                         std::string *lut_preset,
                                                         std::shared_ptr<ProcessingParams> &processing_entry,
-                                                        libraw_processed_image_t *raw_image,
-                                                        QProgressBar *progressBar,
-                                                        MainWindow *mainWindow);
+                                                        libraw_processed_image_t *raw_image);
+
+// File of a LUT preset, relative presets are relative to the OCIO config like OCIO resolves them
+std::string lutPath(const std::string &preset);
 
 #endif // !_UNRAWER_UNRAWER_HPP
@@ -0,0 +1,47 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef _UNRAWER_UNSHARP_HPP
+#define _UNRAWER_UNSHARP_HPP
+
+#include <string>
+
+#include <OpenImageIO/imagebuf.h>
+
+class Lut3D;
+
+// Separable unsharp mask for the gaussian, box and binomial kernels, same kernels as ImageBufAlgo::make_kernel.
+// One pass per row band and cache-sized column tile: source rows are converted to float once into a per-thread ring,
+// blurred vertically then horizontally, and the difference, threshold and add are fused into the store. No
+// full-frame temporary. Edges repeat the border pixels.
+
+bool unsharpSupported(const std::string &kernel);
+
+// `dst` must not be `src`, it is allocated with the spec of `src` when uninitialized.
+// false for other kernels, pixels not in memory, or formats other than uint16 and float, nothing is written then.
+// With `lut` the source rows are graded as they enter the ring, halo rows included, so grading, sharpening and
+// quantisation read `src` once and write `dst` once.
+bool unsharpMask(OIIO::ImageBuf &dst,
+                 const OIIO::ImageBuf &src,
+                 const std::string &kernel,
+                 float width,
+                 float contrast,
+                 float threshold,
+                 const Lut3D *lut = nullptr);
+
+#endif // !_UNRAWER_UNSHARP_HPP
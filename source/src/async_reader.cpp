@@ -0,0 +1,264 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "unrawer/async_reader.hpp"
+#include "unrawer/file_processor.hpp"
+#include "unrawer/log.hpp"
+
+#ifdef UNRAWER_WITH_IOURING
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <liburing.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Largest single read handed to the kernel, files above it are read in several requests
+static constexpr size_t kMaxRead = size_t(1) << 30;
+
+// Requests queued per slot of the window, further files are read synchronously by the pipeline workers
+static constexpr size_t kBacklogPerSlot = 4;
+
+struct AsyncReader::Ring {
+  io_uring ring;
+  int wake_fd = -1;       // eventfd, read through the ring so new requests wake the completion thread
+  uint64_t wake_value = 0;
+};
+
+AsyncReader::AsyncReader(size_t window, Completion completion)
+    : window(std::max<size_t>(1, window)), backlog(this->window * kBacklogPerSlot), completion(std::move(completion)) {
+}
+
+AsyncReader::~AsyncReader() {
+  if (!started) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stop = true;
+  }
+  uint64_t one = 1;
+  (void)::write(ring->wake_fd, &one, sizeof(one));
+  thread.join();
+  io_uring_queue_exit(&ring->ring);
+  ::close(ring->wake_fd);
+}
+
+bool AsyncReader::start() {
+  if (started) {
+    return true;
+  }
+  auto r = std::make_unique<Ring>();
+  // One slot per file in the window plus the wake-up read
+  int ret = io_uring_queue_init(static_cast<unsigned>(window + 1), &r->ring, 0);
+  if (ret < 0) {
+    LOG(warning) << "AsyncReader: io_uring is not available: " << std::strerror(-ret) << std::endl;
+    return false;
+  }
+
+  io_uring_probe *probe = io_uring_get_probe_ring(&r->ring);
+  bool canRead = probe && io_uring_opcode_supported(probe, IORING_OP_READ);
+  if (probe) {
+    io_uring_free_probe(probe);
+  }
+  if (!canRead) {
+    LOG(warning) << "AsyncReader: kernel io_uring does not support reads" << std::endl;
+    io_uring_queue_exit(&r->ring);
+    return false;
+  }
+
+  r->wake_fd = eventfd(0, EFD_CLOEXEC);
+  if (r->wake_fd < 0) {
+    LOG(warning) << "AsyncReader: cannot create eventfd: " << std::strerror(errno) << std::endl;
+    io_uring_queue_exit(&r->ring);
+    return false;
+  }
+
+  ring = std::move(r);
+  started = true;
+  thread = std::thread([this] { loop(); });
+  LOG(debug) << "AsyncReader: io_uring started, " << window << " files in flight" << std::endl;
+  return true;
+}
+
+bool AsyncReader::read(std::shared_ptr<ProcessingParams> processing) {
+  if (!started) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (stop || pending.size() >= backlog) {
+      return false; // completion thread is gone or enough is queued, the caller reads synchronously
+    }
+    auto request = std::make_unique<Request>();
+    request->processing = std::move(processing);
+    pending.push_back(std::move(request));
+  }
+  uint64_t one = 1;
+  (void)::write(ring->wake_fd, &one, sizeof(one));
+  return true;
+}
+
+bool AsyncReader::prepare(Request &request) {
+  const std::string &srcFile = request.processing->srcFile;
+  request.fd = ::open(srcFile.c_str(), O_RDONLY | O_CLOEXEC);
+  if (request.fd < 0) {
+    LOG(error) << "AsyncReader: Could not open file: " << srcFile << std::endl;
+    return false;
+  }
+  struct stat st;
+  if (fstat(request.fd, &st) != 0 || st.st_size <= 0) {
+    LOG(error) << "AsyncReader: Could not determine size of file: " << srcFile << std::endl;
+    return false;
+  }
+  posix_fadvise(request.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  request.buffer = std::make_shared<std::vector<char>>(static_cast<size_t>(st.st_size));
+  return true;
+}
+
+void AsyncReader::complete(Request *request, bool ok) {
+  if (request->fd >= 0) {
+    ::close(request->fd);
+  }
+  if (ok) {
+    request->processing->raw_buffer = std::move(request->buffer);
+  }
+  completion(request->processing, ok);
+  delete request;
+}
+
+void AsyncReader::loop() {
+  io_uring *uring = &ring->ring;
+  std::unordered_set<Request *> active; // owned by the kernel until their completion arrives
+  bool wakeArmed = false;
+
+  auto queueRead = [uring](Request *request) {
+    io_uring_sqe *sqe = io_uring_get_sqe(uring);
+    size_t left = std::min(request->buffer->size() - request->offset, kMaxRead);
+    io_uring_prep_read(sqe, request->fd, request->buffer->data() + request->offset, static_cast<unsigned>(left),
+                       request->offset);
+    io_uring_sqe_set_data(sqe, request);
+  };
+
+  for (;;) {
+    std::vector<std::unique_ptr<Request>> admitted;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      while (active.size() + admitted.size() < window && !pending.empty()) {
+        admitted.push_back(std::move(pending.front()));
+        pending.pop_front();
+      }
+      if (stop && admitted.empty() && active.empty()) {
+        break;
+      }
+    }
+    // Opened outside the lock, read() never waits on a slow open
+    for (auto &request : admitted) {
+      if (prepare(*request)) {
+        active.insert(request.get());
+        queueRead(request.release());
+      } else {
+        complete(request.release(), false);
+      }
+    }
+    if (!wakeArmed) {
+      io_uring_sqe *sqe = io_uring_get_sqe(uring);
+      io_uring_prep_read(sqe, ring->wake_fd, &ring->wake_value, sizeof(ring->wake_value), 0);
+      io_uring_sqe_set_data(sqe, nullptr);
+      wakeArmed = true;
+    }
+    io_uring_submit(uring);
+
+    io_uring_cqe *cqe = nullptr;
+    int ret = io_uring_wait_cqe(uring, &cqe);
+    if (ret == -EINTR) {
+      continue;
+    }
+    if (ret < 0) {
+      LOG(error) << "AsyncReader: io_uring wait failed: " << std::strerror(-ret) << std::endl;
+      break;
+    }
+
+    do {
+      auto *request = static_cast<Request *>(io_uring_cqe_get_data(cqe));
+      int res = cqe->res;
+      io_uring_cqe_seen(uring, cqe);
+
+      if (request == nullptr) {
+        wakeArmed = false; // new requests or stop, picked up at the top of the loop
+      } else if (res == -EINTR || res == -EAGAIN) {
+        queueRead(request);
+      } else if (res <= 0) {
+        LOG(error) << "AsyncReader: Could not read file: " << request->processing->srcFile << ": "
+                   << (res < 0 ? std::strerror(-res) : "unexpected end of file") << std::endl;
+        active.erase(request);
+        complete(request, false);
+      } else {
+        request->offset += static_cast<size_t>(res);
+        if (request->offset < request->buffer->size()) {
+          queueRead(request); // short read, continue where it stopped
+        } else {
+          active.erase(request);
+          complete(request, true);
+        }
+      }
+    } while (io_uring_peek_cqe(uring, &cqe) == 0);
+  }
+
+  std::lock_guard<std::mutex> lock(mtx);
+  if (!active.empty()) {
+    // The ring failed: the files still fail so the batch can end, their buffers outlive the reader as the kernel
+    // may still write into them
+    LOG(error) << "AsyncReader: " << active.size() << " reads abandoned" << std::endl;
+    for (Request *request : active) {
+      abandoned.push_back(request->buffer);
+      complete(request, false);
+    }
+  }
+  stop = true;
+  for (auto &request : pending) {
+    complete(request.release(), false);
+  }
+  pending.clear();
+}
+
+#else // !UNRAWER_WITH_IOURING
+
+struct AsyncReader::Ring {};
+
+AsyncReader::AsyncReader(size_t window, Completion completion)
+    : window(window), backlog(0), completion(std::move(completion)) {}
+
+AsyncReader::~AsyncReader() = default;
+
+bool AsyncReader::start() {
+  LOG(warning) << "AsyncReader: built without io_uring support" << std::endl;
+  return false;
+}
+
+bool AsyncReader::read(std::shared_ptr<ProcessingParams> processing) { return false; }
+
+void AsyncReader::loop() {}
+
+void AsyncReader::complete(Request *request, bool ok) {}
+
+#endif
@@ -0,0 +1,274 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <unordered_set>
+
+#include "unrawer/batch.hpp"
+#include "unrawer/dir_walker.hpp"
+#include "unrawer/folder_watcher.hpp"
+#include "unrawer/journal.hpp"
+#include "unrawer/processors.hpp"
+#include "unrawer/threadpool.hpp"
+#include "unrawer/unrawer.hpp"
+
+ProcessGlobals procGlobals;
+
+// Sessions install their pools in procGlobals, a second one would swap them under the first one's workers
+static std::mutex sessionMutex;
+
+static BatchProgress snapshot(const Pipeline &pipeline) {
+  BatchProgress progress;
+  progress.files = pipeline.total();
+  progress.written = pipeline.written();
+  progress.failed = pipeline.failed();
+  progress.skipped = pipeline.skipped();
+  progress.scanning = !pipeline.isClosed();
+  progress.fraction = pipeline.progress();
+  return progress;
+}
+
+static void watchProgress(Pipeline *pipeline, const BatchObserver *observer) {
+  while (!pipeline->finished()) {
+    observer->progress(snapshot(*pipeline));
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+  }
+}
+
+static size_t workerCount(size_t workers) {
+  return workers > 0 ? workers : std::max<size_t>(1, floor(std::thread::hardware_concurrency() * settings.mltThreads));
+}
+
+// Executor, pools and pipeline of one batch. Built once and fed for as long as files arrive, a one-off batch and a
+// watched folder only differ in where the files come from.
+class BatchSession {
+public:
+  BatchSession(const BatchObserver &observer, const BatchOptions &options);
+
+  bool isRaw(const std::string &file) const { return ::isRaw(file, raw_ext_set); }
+  // raw files enter the graph unless the journal lists them as done, anything else is logged and skipped
+  void submit(const std::string &file);
+
+  BatchSummary finish(); // no more files, waits for the ones in flight
+
+private:
+  std::unique_lock<std::mutex> exclusive; // first member: held until everything below is torn down
+  const BatchObserver &observer;
+  BatchJournal *journal;
+  unrw::Timer timer;
+  std::unordered_set<std::string> raw_ext_set;
+  std::atomic<size_t> inputBytes{0};
+  std::atomic<size_t> resumed{0};
+
+  // One work-stealing executor for all stages, any idle core picks up whatever stage is ready
+  Scheduler scheduler;
+  ThreadPool progressPool{1, 1}; // Progress pool, long running task kept off the scheduler workers
+  LibRawPool librawPool;
+  BufferPool bufferPool;
+  MemoryBudget memBudget;
+  Pipeline pipeline;
+  std::unique_ptr<AsyncReader> asyncReader;
+};
+
+BatchSession::BatchSession(const BatchObserver &observer, const BatchOptions &options)
+    : exclusive(sessionMutex), observer(observer), journal(options.journal), scheduler(workerCount(options.workers)),
+      librawPool(scheduler.size()),
+      bufferPool(static_cast<size_t>(settings.poolCache) << 20, settings.hugePages),
+      memBudget(static_cast<size_t>(settings.memLimit) << 20), // bytes, 0 - unlimited
+      pipeline(&scheduler, static_cast<PipelineMode>(settings.pipelineMode), &memBudget) {
+  // todo: add support for user defined raw formats and move to global scope?
+  auto raw_ext = OIIO::get_extension_map()["raw"];
+  raw_ext_set.insert(raw_ext.begin(), raw_ext.end());
+  // end todo
+
+  procGlobals.ocio_conf_ptr = procGlobals.color_cache.config(settings.ocioConfigPath); // loaded once per session
+
+  // Read and write start from the configured I/O thread count, the balancer moves workers to the bottleneck
+  size_t ioThreads = settings.numThreads > 0 ? settings.numThreads : scheduler.size();
+  scheduler.setStageLimit(Stage::Reader, ioThreads);
+  scheduler.setStageLimit(Stage::Writer, ioThreads);
+  scheduler.setStageLimit(Stage::RawDump, ioThreads);
+  scheduler.startBalancer(std::chrono::milliseconds(250));
+  procGlobals.libraw_pool = &librawPool;
+  procGlobals.buffer_pool = settings.poolCache > 0 ? &bufferPool : nullptr;
+
+  if (settings.readMode == 2) {
+    asyncReader = std::make_unique<AsyncReader>(
+        settings.readAhead, [this](std::shared_ptr<ProcessingParams> &processing, bool ok) {
+          pipeline.resume(Stage::Reader, processing, ok ? Step::to(Stage::Unpacker) : Step::failed());
+        });
+    if (!asyncReader->start()) {
+      LOG(warning) << "Async reads are not available, using memory-mapped reads" << std::endl;
+      asyncReader.reset();
+    }
+  }
+  procGlobals.async_reader = asyncReader.get();
+
+  if (observer.fileDone || journal) {
+    pipeline.onFileDone([this](const ProcessingParams &processing, bool ok) {
+      if (journal) {
+        journal->record(processing.srcFile, ok);
+      }
+      if (this->observer.fileDone) {
+        this->observer.fileDone(processing.srcFile, ok);
+      }
+    });
+  }
+  if (observer.progress) {
+    progressPool.enqueue(watchProgress, &pipeline, &observer);
+  }
+}
+
+// Every file enters the graph at the sorter and walks it to Done or Failed
+void BatchSession::submit(const std::string &file) {
+  LOG(trace) << "SORT: File: " << file << std::endl;
+  if (isRaw(file)) {
+    if (journal && journal->completed(file)) {
+      LOG(debug) << "SORT: Done in an earlier run: " << file << std::endl;
+      ++resumed;
+      return;
+    }
+    std::error_code ec;
+    auto size = std::filesystem::file_size(file, ec);
+    inputBytes += ec ? 0 : static_cast<size_t>(size);
+    pipeline.submit(file);
+  } else {
+    LOG(error) << "SORT: Not a raw file: " << file << std::endl;
+  }
+}
+
+BatchSummary BatchSession::finish() {
+  pipeline.close();
+  pipeline.wait();
+  procGlobals.async_reader = nullptr;
+  procGlobals.libraw_pool = nullptr;
+  procGlobals.buffer_pool = nullptr;
+  progressPool.waitForAllTasks();
+  double wallSec = timer.now<double>();
+  pipeline.report(wallSec);
+  if (settings.poolCache > 0) {
+    bufferPool.report();
+  }
+
+  BatchSummary summary;
+  summary.files = pipeline.total();
+  summary.written = pipeline.written();
+  summary.failed = pipeline.failed();
+  summary.skipped = pipeline.skipped();
+  summary.resumed = resumed;
+  summary.inputBytes = inputBytes;
+  summary.bytesCopied = pipeline.bytesCopied();
+  summary.memoryHighWater = memBudget.highWater();
+  summary.workers = scheduler.size();
+  summary.seconds = wallSec;
+  summary.mode = settings.pipelineMode == 1 ? "fused" : "staged";
+  for (size_t s = 0; s < kStageCount; ++s) {
+    Stage stage = static_cast<Stage>(s);
+    PipelineStageTotals totals = pipeline.stageTotals(stage);
+    if (totals.files > 0) {
+      summary.stages.push_back({stageName(stage), totals.files, totals.failed, totals.busySec});
+    }
+  }
+
+  if (observer.progress) {
+    observer.progress(snapshot(pipeline));
+  }
+  return summary;
+}
+
+void clearColorCaches() {
+  procGlobals.color_cache.clear();
+  procGlobals.lut_cache.clear();
+}
+
+BatchSummary runBatch(const std::vector<std::string> &paths,
+                      const BatchObserver &observer,
+                      const BatchOptions &options) {
+  BatchSession session(observer, options);
+
+  // Directories are scanned in parallel and stream their files into the pipeline, so processing starts with the
+  // first file found instead of after the whole tree is listed
+  auto submitFile = [&session](const std::string &file) { session.submit(file); };
+  DirWalker walker(settings.numThreads > 0 ? settings.numThreads : 4, submitFile);
+  for (const std::string &path : paths) {
+    std::error_code ec;
+    std::filesystem::path absolute = std::filesystem::absolute(path, ec);
+    if (std::filesystem::is_directory(absolute, ec)) {
+      walker.walk(absolute.lexically_normal().string());
+    } else {
+      submitFile(path);
+    }
+  }
+  walker.wait();
+  LOG(debug) << "SORT: " << walker.files() << " files in " << walker.dirs() << " directories" << std::endl;
+
+  return session.finish();
+}
+
+std::future<BatchSummary> submitBatch(std::vector<std::string> paths,
+                                      BatchObserver observer,
+                                      BatchOptions options) {
+  return std::async(std::launch::async, [paths = std::move(paths), observer = std::move(observer), options] {
+    return runBatch(paths, observer, options);
+  });
+}
+
+std::pair<bool, BatchSummary> watchFolders(const std::vector<std::string> &folders,
+                                           const BatchObserver &observer,
+                                           const std::atomic<bool> &stop,
+                                           std::chrono::milliseconds settle,
+                                           const BatchOptions &options) {
+  std::unique_ptr<BatchSession> session;
+  // Arrivals are submitted from a thread of their own: with a memory limit submit() blocks until the file fits, the
+  // watcher thread has to keep draining inotify and polling `stop` meanwhile
+  ThreadPool feeder(1, 64);
+  // Only raw files are debounced, sidecars and the converted files written next to them are ignored
+  FolderWatcher watcher(
+      settle,
+      [&session](const std::string &file) { return session->isRaw(file); },
+      [&session, &feeder](const std::string &file) {
+        LOG(info) << "WATCH: " << file << " arrived" << std::endl;
+        feeder.enqueue_async([&session, file] { session->submit(file); });
+      });
+  if (!watcher.start()) {
+    return {false, {}};
+  }
+  // Pools and workers are only built once inotify is known to work
+  session = std::make_unique<BatchSession>(observer, options);
+  for (const std::string &folder : folders) {
+    if (!watcher.add(folder)) {
+      session->finish();
+      return {false, {}};
+    }
+  }
+  LOG(info) << "WATCH: " << watcher.folders() << " folders watched, files are processed " << settle.count()
+            << " ms after they stop changing" << std::endl;
+
+  watcher.run(stop);
+
+  LOG(info) << "WATCH: Stopping, waiting for the files in flight" << std::endl;
+  feeder.waitForAllTasks(); // files that arrived before the stop are still processed
+  return {true, session->finish()};
+}
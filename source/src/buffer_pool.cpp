@@ -0,0 +1,180 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "unrawer/buffer_pool.hpp"
+#include "unrawer/log.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// Size class granularity, also the huge page size on x86-64 and most arm64 kernels
+static constexpr size_t kBlockAlign = size_t(2) << 20;
+
+static size_t blockSize(size_t bytes) {
+  return (std::max<size_t>(bytes, 1) + kBlockAlign - 1) / kBlockAlign * kBlockAlign;
+}
+
+PooledBuffer::PooledBuffer(PooledBuffer &&other) noexcept
+    : pool(std::exchange(other.pool, nullptr)), ptr(std::exchange(other.ptr, nullptr)),
+      len(std::exchange(other.len, 0)), block(std::exchange(other.block, 0)) {}
+
+PooledBuffer &PooledBuffer::operator=(PooledBuffer &&other) noexcept {
+  if (this != &other) {
+    reset();
+    pool = std::exchange(other.pool, nullptr);
+    ptr = std::exchange(other.ptr, nullptr);
+    len = std::exchange(other.len, 0);
+    block = std::exchange(other.block, 0);
+  }
+  return *this;
+}
+
+void PooledBuffer::reset() {
+  if (ptr) {
+    pool->give(ptr, block);
+    pool = nullptr;
+    ptr = nullptr;
+    len = 0;
+    block = 0;
+  }
+}
+
+BufferPool::BufferPool(size_t cacheLimit, bool hugePages) : cacheLimit(cacheLimit), hugePages(hugePages) {}
+
+BufferPool::~BufferPool() {
+  for (auto &[block, blocks] : free) {
+    for (void *ptr : blocks) {
+      unmap(ptr, block);
+    }
+  }
+}
+
+PooledBuffer BufferPool::acquire(size_t bytes) {
+  size_t block = blockSize(bytes);
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    // Smallest cached block that fits without wasting more than 1/8
+    auto it = free.lower_bound(block);
+    if (it != free.end() && it->first <= block + block / 8) {
+      void *ptr = it->second.back();
+      size_t found = it->first;
+      it->second.pop_back();
+      if (it->second.empty()) {
+        free.erase(it);
+      }
+      cached -= found;
+      inUse += found;
+      ++hits;
+      return PooledBuffer(this, ptr, bytes, found);
+    }
+    ++misses;
+  }
+
+  void *ptr = map(block);
+  if (ptr == nullptr) {
+    LOG(error) << "BufferPool: cannot allocate " << (block >> 20) << " MB" << std::endl;
+    return PooledBuffer();
+  }
+  std::lock_guard<std::mutex> lock(mtx);
+  inUse += block;
+  peak = std::max(peak, inUse + cached);
+  return PooledBuffer(this, ptr, bytes, block);
+}
+
+void BufferPool::give(void *ptr, size_t block) {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    inUse -= block;
+    if (cached + block <= cacheLimit) {
+      free[block].push_back(ptr);
+      cached += block;
+      return;
+    }
+  }
+  unmap(ptr, block);
+}
+
+BufferPool::Stats BufferPool::stats() const {
+  std::lock_guard<std::mutex> lock(mtx);
+  return {hits, misses, inUse, cached, peak};
+}
+
+void BufferPool::report() const {
+  Stats s = stats();
+  size_t requests = s.hits + s.misses;
+  LOG(info) << "BufferPool: " << requests << " buffers, " << (requests ? s.hits * 100 / requests : 0)
+            << "% reused, high water " << (s.highWater >> 20) << " MB, " << (s.cached >> 20) << " MB cached"
+            << (hugePages ? ", huge pages" : "") << std::endl;
+}
+
+#ifdef _WIN32
+
+void *BufferPool::map(size_t block) {
+  if (hugePages) {
+    // Needs SeLockMemoryPrivilege, silently falls back to normal pages without it
+    size_t large = GetLargePageMinimum();
+    if (large > 0 && block % large == 0) {
+      void *ptr = VirtualAlloc(nullptr, block, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+      if (ptr) {
+        return ptr;
+      }
+    }
+  }
+  return VirtualAlloc(nullptr, block, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+void BufferPool::unmap(void *ptr, size_t block) { VirtualFree(ptr, 0, MEM_RELEASE); }
+
+#else
+
+void *BufferPool::map(size_t block) {
+#ifdef MAP_HUGETLB
+  if (hugePages) {
+    // Reserved huge pages (vm.nr_hugepages) first, transparent huge pages below otherwise
+    void *ptr = mmap(nullptr, block, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr != MAP_FAILED) {
+      return ptr;
+    }
+  }
+#endif
+  void *ptr = mmap(nullptr, block, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) {
+    return nullptr;
+  }
+#ifdef MADV_HUGEPAGE
+  if (hugePages) {
+    madvise(ptr, block, MADV_HUGEPAGE);
+  }
+#endif
+  return ptr;
+}
+
+void BufferPool::unmap(void *ptr, size_t block) { munmap(ptr, block); }
+
+#endif
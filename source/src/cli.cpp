@@ -0,0 +1,267 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "unrawer/batch.hpp"
+#include "unrawer/journal.hpp"
+#include "unrawer/log.hpp"
+#include "unrawer/settings.hpp"
+#include "unrawer/version.hpp"
+
+// Headless batch runner: the same stage pipeline as the window, driven from the command line. No widgets and no
+// event loop are created, logs go to stderr and stdout only carries the JSON summary.
+
+static void usage(const char *argv0) {
+  std::cerr << "UnRAWer " << VERSION_MAJOR << "." << VERSION_MINOR << " command line batch processor\n"
+            << "Usage: " << argv0 << " [options] <file or directory>...\n"
+            << "  -c, --config FILE      settings file (default: unrw_config.toml)\n"
+            << "  -s, --set S.KEY=VALUE  override a setting of the file, repeatable, e.g. Global.PipelineMode=1\n"
+            << "  -j, --threads N        scheduler worker threads (default: hardware threads * ThredsMult)\n"
+            << "      --io-threads N     workers reading and writing at once at start (default: Global.Threads)\n"
+            << "  -v, --verbosity N      0 - none ... 3 - info, 4 - debug, 5 - trace (default: 2)\n"
+            << "  -p, --progress         progress on stderr\n"
+            << "  -o, --summary FILE     write the JSON summary to FILE instead of stdout\n"
+            << "  -w, --watch            keep watching the directories and process raw files as they land, until\n"
+            << "                         SIGINT or SIGTERM. Files already there are left alone (Linux only)\n"
+            << "      --settle MS        watch mode: wait until a file has not changed for MS (default: 2000)\n"
+            << "      --journal FILE     record every finished file in FILE, a new batch starts it over\n"
+            << "      --resume           continue the batch recorded in the --journal file, files it lists as\n"
+            << "                         done are not processed again\n"
+            << "  -h, --help\n"
+            << "Exit status: 0 all files written or up to date, 1 some files failed or none found,\n"
+            << "             2 usage or settings error\n"
+            << "In watch mode 0 unless some file failed\n";
+}
+
+// Set from the signal handler, the watch loop polls it
+static std::atomic<bool> stopWatching{false};
+
+static void onStopSignal(int) { stopWatching = true; }
+
+static bool toCount(const std::string &text, size_t &value) {
+  char *end = nullptr;
+  unsigned long long v = std::strtoull(text.c_str(), &end, 10);
+  if (text.empty() || *end != '\0' || v == 0) {
+    return false;
+  }
+  value = static_cast<size_t>(v);
+  return true;
+}
+
+static std::string summaryJson(const BatchSummary &summary) {
+  double mb = static_cast<double>(summary.inputBytes) / (1 << 20);
+  double sec = summary.seconds > 0.0 ? summary.seconds : 1e-9;
+  std::ostringstream json;
+  json << std::fixed << std::setprecision(3);
+  json << "{\n"
+       << "  \"files\": " << summary.files << ",\n"
+       << "  \"written\": " << summary.written << ",\n"
+       << "  \"failed\": " << summary.failed << ",\n"
+       << "  \"skipped\": " << summary.skipped << ",\n"
+       << "  \"resumed\": " << summary.resumed << ",\n"
+       << "  \"seconds\": " << summary.seconds << ",\n"
+       << "  \"files_per_sec\": " << summary.written / sec << ",\n"
+       << "  \"input_mb\": " << mb << ",\n"
+       << "  \"input_mb_per_sec\": " << mb / sec << ",\n"
+       << "  \"workers\": " << summary.workers << ",\n"
+       << "  \"mode\": \"" << summary.mode << "\",\n"
+       << "  \"memory_high_water_mb\": " << static_cast<double>(summary.memoryHighWater) / (1 << 20) << ",\n"
+       << "  \"copied_mb\": " << static_cast<double>(summary.bytesCopied) / (1 << 20) << ",\n"
+       << "  \"stages\": [";
+  for (size_t i = 0; i < summary.stages.size(); ++i) {
+    const BatchStage &stage = summary.stages[i];
+    json << (i ? "," : "") << "\n    {\"name\": \"" << stage.name << "\", \"files\": " << stage.files
+         << ", \"failed\": " << stage.failed << ", \"busy_sec\": " << stage.busySec
+         << ", \"ms_per_file\": " << stage.busySec * 1000.0 / stage.files
+         << ", \"files_per_sec\": " << stage.files / sec << "}";
+  }
+  json << (summary.stages.empty() ? "]\n" : "\n  ]\n") << "}\n";
+  return json.str();
+}
+
+int main(int argc, char *argv[]) {
+  std::string configFile = "unrw_config.toml";
+  bool configGiven = false;
+  std::vector<std::string> overrides;
+  std::vector<std::string> paths;
+  std::string summaryFile;
+  size_t workers = 0;
+  size_t ioThreads = 0;
+  int verbosity = 2;
+  bool progress = false;
+  bool watch = false;
+  size_t settleMs = 2000;
+  std::string journalFile;
+  bool resume = false;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto value = [&](std::string &out) {
+      if (i + 1 >= argc) {
+        std::cerr << "Missing value for " << arg << "\n";
+        return false;
+      }
+      out = argv[++i];
+      return true;
+    };
+    std::string v;
+    if (arg == "-h" || arg == "--help") {
+      usage(argv[0]);
+      return 0;
+    } else if (arg == "-c" || arg == "--config") {
+      if (!value(configFile)) {
+        return 2;
+      }
+      configGiven = true;
+    } else if (arg == "-s" || arg == "--set") {
+      if (!value(v)) {
+        return 2;
+      }
+      overrides.push_back(v);
+    } else if (arg == "-j" || arg == "--threads") {
+      if (!value(v) || !toCount(v, workers)) {
+        std::cerr << "Invalid thread count: " << v << "\n";
+        return 2;
+      }
+    } else if (arg == "--io-threads") {
+      if (!value(v) || !toCount(v, ioThreads)) {
+        std::cerr << "Invalid I/O thread count: " << v << "\n";
+        return 2;
+      }
+    } else if (arg == "-v" || arg == "--verbosity") {
+      if (!value(v) || v.size() != 1 || v[0] < '0' || v[0] > '5') {
+        std::cerr << "Invalid verbosity: " << v << "\n";
+        return 2;
+      }
+      verbosity = v[0] - '0';
+    } else if (arg == "-p" || arg == "--progress") {
+      progress = true;
+    } else if (arg == "-o" || arg == "--summary") {
+      if (!value(summaryFile)) {
+        return 2;
+      }
+    } else if (arg == "-w" || arg == "--watch") {
+      watch = true;
+    } else if (arg == "--settle") {
+      if (!value(v) || !toCount(v, settleMs)) {
+        std::cerr << "Invalid settle time: " << v << "\n";
+        return 2;
+      }
+    } else if (arg == "--journal") {
+      if (!value(journalFile)) {
+        return 2;
+      }
+    } else if (arg == "--resume") {
+      resume = true;
+    } else if (arg.size() > 1 && arg[0] == '-') {
+      std::cerr << "Unknown option: " << arg << "\n";
+      usage(argv[0]);
+      return 2;
+    } else {
+      paths.push_back(arg);
+    }
+  }
+  if (paths.empty()) {
+    usage(argv[0]);
+    return 2;
+  }
+  if (resume && journalFile.empty()) {
+    std::cerr << "--resume needs --journal\n";
+    return 2;
+  }
+
+  Log_Init(std::clog);
+  Log_SetVerbosity(verbosity);
+
+  if (!loadSettings(settings, configFile, overrides)) {
+    if (configGiven || !overrides.empty()) {
+      LOG(fatal) << "Can not load [" << configFile << "]" << std::endl;
+      return 2;
+    }
+    LOG(error) << "Can not load [" << configFile << "] Using default settings." << std::endl;
+    settings.reSettings();
+  }
+  if (ioThreads > 0) {
+    settings.numThreads = static_cast<uint>(ioThreads);
+  }
+  if (verbosity >= 4) {
+    printSettings(settings);
+  }
+
+  // Opened once the settings are final, the journal is only resumed with the settings it was started with
+  BatchJournal journal;
+  BatchOptions options;
+  options.workers = workers;
+  if (!journalFile.empty()) {
+    if (!journal.open(journalFile, resume)) {
+      return 2;
+    }
+    options.journal = &journal;
+  }
+
+  BatchObserver observer;
+  if (progress) {
+    observer.progress = [](const BatchProgress &state) {
+      std::cerr << "\rProgress: " << std::setw(3) << static_cast<int>(state.fraction * 100.0f) << "%, " << state.files
+                << (state.scanning ? " files, scanning" : " files          ") << std::flush;
+    };
+  }
+  BatchSummary summary;
+  if (watch) {
+    std::signal(SIGINT, onStopSignal);
+    std::signal(SIGTERM, onStopSignal);
+    bool watched;
+    std::tie(watched, summary) =
+        watchFolders(paths, observer, stopWatching, std::chrono::milliseconds(settleMs), options);
+    if (!watched) {
+      return 2;
+    }
+  } else {
+    summary = runBatch(paths, observer, options);
+  }
+  if (progress) {
+    std::cerr << std::endl;
+  }
+
+  std::string json = summaryJson(summary);
+  if (summaryFile.empty()) {
+    std::cout << json << std::flush;
+  } else {
+    std::ofstream out(summaryFile);
+    out << json;
+    if (!out) {
+      LOG(error) << "Can not write summary to " << summaryFile << std::endl;
+      return 2;
+    }
+  }
+  if (watch) {
+    return summary.failed == 0 ? 0 : 1;
+  }
+  return summary.failed == 0 && summary.written + summary.skipped + summary.resumed > 0 ? 0 : 1;
+}
@@ -0,0 +1,60 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "unrawer/color_cache.hpp"
+#include "unrawer/log.hpp"
+
+std::shared_ptr<OIIO::ColorConfig> ColorCache::configLocked(const std::string &path) {
+  if (!colorConfig || path != configPath) {
+    LOG(debug) << "ColorCache: loading OCIO config " << (path.empty() ? std::string("$OCIO") : path) << std::endl;
+    colorConfig = std::make_shared<OIIO::ColorConfig>(path);
+    configPath = path;
+    processors.clear(); // built from the previous config
+  }
+  return colorConfig;
+}
+
+std::shared_ptr<OIIO::ColorConfig> ColorCache::config(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mtx);
+  return configLocked(path);
+}
+
+OIIO::ColorProcessorHandle ColorCache::fileTransform(const std::string &path, const std::string &name, bool inverse) {
+  std::lock_guard<std::mutex> lock(mtx);
+  std::shared_ptr<OIIO::ColorConfig> conf = configLocked(path);
+  auto key = std::make_tuple(path, name, inverse);
+  auto it = processors.find(key);
+  if (it != processors.end()) {
+    return it->second;
+  }
+  // Built under the lock: workers starting on the same preset wait for one build instead of racing
+  OIIO::ColorProcessorHandle processor = conf->createFileTransform(name, inverse);
+  if (!processor) {
+    LOG(error) << "ColorCache: OCIO cannot build file transform " << name << ": " << conf->geterror() << std::endl;
+  } else {
+    LOG(debug) << "ColorCache: compiled file transform " << name << std::endl;
+  }
+  processors.emplace(key, processor); // failures are cached too, the log is not repeated for every file
+  return processor;
+}
+
+void ColorCache::clear() {
+  std::lock_guard<std::mutex> lock(mtx);
+  processors.clear();
+  colorConfig.reset();
+  configPath.clear();
+}
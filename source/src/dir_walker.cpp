@@ -0,0 +1,62 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <filesystem>
+#include <system_error>
+
+#include "unrawer/dir_walker.hpp"
+#include "unrawer/log.hpp"
+
+namespace fs = std::filesystem;
+
+DirWalker::DirWalker(size_t threads, Visitor visitor)
+    : visitor(std::move(visitor)), pool(std::max<size_t>(1, threads), 1024) {}
+
+void DirWalker::walk(const std::string &dir) { pool.enqueue_async(&DirWalker::scan, this, dir); }
+
+void DirWalker::wait() { pool.waitForAllTasks(); }
+
+bool DirWalker::firstVisit(const std::string &dir) {
+  std::error_code ec;
+  fs::path canonical = fs::canonical(fs::u8path(dir), ec);
+  std::lock_guard<std::mutex> lock(visited_mutex);
+  return visited.insert(ec ? dir : canonical.u8string()).second;
+}
+
+void DirWalker::scan(const std::string &dir) {
+  if (!firstVisit(dir)) {
+    LOG(trace) << "SORT: Directory already visited: " << dir << std::endl;
+    return;
+  }
+  LOG(trace) << "SORT: Directory: " << dir << std::endl;
+
+  try {
+    fs::directory_iterator it(fs::u8path(dir), fs::directory_options::skip_permission_denied);
+    for (const fs::directory_entry &entry : it) {
+      std::error_code ec;
+      if (entry.is_directory(ec)) { // follows symlinks
+        pool.enqueue_async(&DirWalker::scan, this, entry.path().u8string());
+      } else if (entry.is_regular_file(ec)) {
+        ++files_found;
+        visitor(entry.path().u8string());
+      }
+    }
+  } catch (const fs::filesystem_error &e) {
+    LOG(error) << "SORT: Cannot list directory " << dir << ": " << e.what() << std::endl;
+  }
+  ++dirs_listed;
+}
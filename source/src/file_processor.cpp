@@ -23,24 +23,22 @@ std::string toLower(const std::string &str) {
   return strCopy;
 }
 
-void getWritableExt(QString *ext, Settings *settings) {
+void getWritableExt(std::string *ext, Settings *settings) {
   std::unique_ptr<ImageOutput> probe;
-  QString fn = "probename" + *ext;
-  probe = ImageOutput::create(fn.toStdString());
+  std::string fn = "probename" + *ext;
+  probe = ImageOutput::create(fn);
   if (probe) {
-    LOG(info) << ext->toStdString() << " is writable" << std::endl;
+    LOG(info) << *ext << " is writable" << std::endl;
   } else {
-    LOG(info) << ext->toStdString() << " is readonly" << std::endl;
+    LOG(info) << *ext << " is readonly" << std::endl;
     LOG(info) << "Output format changed to " << settings->out_formats[settings->defFormat] << std::endl;
-    *ext = "." + QString::fromStdString(settings->out_formats[settings->defFormat]);
+    *ext = "." + settings->out_formats[settings->defFormat];
   }
   probe.reset();
 }
 
-QString getExtension(QString &extension, Settings *settings) {
-  // QFileInfo fileInfo(fileName);
-  // QString extension = "." + fileInfo.completeSuffix();
-  extension = extension.toLower();
+std::string getExtension(std::string &extension, Settings *settings) {
+  extension = toLower(extension);
   switch (settings->fileFormat) {
     //-1 - original, 0 - TIFF, 1 - OpenEXR, 2 - PNG, 3 - JPEG, 4 - JPEG-2000, 5 - PPM
   case 0:
@@ -59,49 +57,58 @@ QString getExtension(QString &extension, Settings *settings) {
   // Only RAW fils are supported
   // No need to check if extension is writable
   // getWritableExt(&extension, settings);
-  extension = "." + QString::fromStdString(settings->out_formats[settings->defFormat]);
+  extension = "." + settings->out_formats[settings->defFormat];
   return extension;
 }
 
-std::tuple<QString, QString, QString, QString>
-splitPath(const QString &fileName) { // returns path, parent folder, base name, extension
-  QFileInfo fileInfo(fileName);
-  QString path = fileInfo.absolutePath();
-  QDir parentFolder = fileInfo.dir();
-  QString baseName = fileInfo.baseName();
-  QString extension = "." + fileInfo.completeSuffix();
-  return {path, parentFolder.dirName(), baseName, extension};
+// Base name is everything before the first dot, the suffix everything after it, as QFileInfo splits them
+static std::pair<std::string, std::string> splitName(const std::filesystem::path &file) {
+  std::string name = file.filename().string();
+  size_t dot = name.find('.');
+  if (dot == std::string::npos) {
+    return {name, ""};
+  }
+  return {name.substr(0, dot), name.substr(dot + 1)};
+}
+
+std::tuple<std::string, std::string, std::string, std::string>
+splitPath(const std::string &fileName) { // returns path, parent folder, base name, extension
+  std::filesystem::path file = std::filesystem::absolute(fileName).lexically_normal();
+  std::filesystem::path parent = file.parent_path();
+  auto [baseName, suffix] = splitName(file);
+  return {parent.generic_string(), parent.filename().string(), baseName, "." + suffix};
 }
 
-std::optional<std::string> getPresetfromName(const QString &fileName, Settings *settings) {
-  QFileInfo fileInfo(fileName);
-  QString baseName = fileInfo.baseName();
-  QString path = fileInfo.absolutePath();
+std::optional<std::string> getPresetfromName(const std::string &fileName, Settings *settings) {
+  std::filesystem::path file = std::filesystem::absolute(fileName).lexically_normal();
+  std::string baseName = toLower(splitName(file).first);
+  std::string path = toLower(file.parent_path().generic_string());
   // find if path or baseName contains any of settings.lut_Preset strings
   for (auto &lut_preset : settings->lut_Preset) {
-    QString lut_preset_key = lut_preset.first.c_str();
-    if (path.contains(lut_preset_key, Qt::CaseInsensitive) || baseName.contains(lut_preset_key, Qt::CaseInsensitive)) {
+    std::string lut_preset_key = toLower(lut_preset.first);
+    if (path.find(lut_preset_key) != std::string::npos || baseName.find(lut_preset_key) != std::string::npos) {
       return lut_preset.first;
     }
   }
   return std::nullopt;
 }
 
-std::tuple<QString, QString, QString>
-getOutName(QString &path, QString &baseName, QString &extension, QString &prest_sfx, Settings *settings) {
-  // QFileInfo fileInfo(fileName);
-  // QString baseName = fileInfo.baseName();
-  // QString path = fileInfo.absolutePath();
-  QString outPath = path;
+std::tuple<std::string, std::string, std::string> getOutName(std::string &path,
+                                                             std::string &baseName,
+                                                             std::string &extension,
+                                                             std::string &prest_sfx,
+                                                             Settings *settings) {
+  std::string outPath = path;
   if (settings->pathPrefix != "") {
-    outPath += "/" + QString(settings->pathPrefix.c_str());
+    outPath += "/" + settings->pathPrefix;
   }
-  QString outName = baseName;
-  QString proc_sfx = "_conv";
-  QString outExt;
+  std::string outName = baseName;
+  std::string proc_sfx = "_conv";
+  std::string outExt;
   if (prest_sfx != "") {
-    if (prest_sfx.startsWith("_")) {
-      prest_sfx = prest_sfx.replace(QRegularExpression("_{2,}"), "_");
+    if (prest_sfx.front() == '_') {
+      static const std::regex repeated("_{2,}");
+      prest_sfx = std::regex_replace(prest_sfx, repeated, "_");
       proc_sfx = prest_sfx;
     } else {
       proc_sfx = "_" + prest_sfx;
@@ -116,4 +123,20 @@ getOutName(QString &path, QString &baseName, QString &extension, QString &prest_
     outName += proc_sfx;
   }
   return {outPath, outName, outExt};
-}
\ No newline at end of file
+}
+
+std::string resolveSymlink(const std::string &fileName) {
+  std::error_code ec;
+  std::filesystem::path file(fileName);
+  if (!std::filesystem::is_symlink(file, ec)) {
+    return fileName;
+  }
+  std::filesystem::path target = std::filesystem::read_symlink(file, ec);
+  if (ec) {
+    return fileName;
+  }
+  if (target.is_relative()) {
+    target = file.parent_path() / target;
+  }
+  return target.lexically_normal().string();
+}
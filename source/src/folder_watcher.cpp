@@ -0,0 +1,242 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "unrawer/folder_watcher.hpp"
+#include "unrawer/log.hpp"
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// Longest wait between checks of the stop flag
+static constexpr int kMaxWaitMs = 250;
+
+// Completed files, writes to files still settling and folders that grow the tree. Deleted or moved away folders
+// drop their watch on their own through IN_IGNORED.
+static constexpr uint32_t kWatchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY | IN_CREATE | IN_ONLYDIR;
+
+FolderWatcher::FolderWatcher(std::chrono::milliseconds settle, Filter wanted, Arrival arrival)
+    : settle(settle), wanted(std::move(wanted)), arrival(std::move(arrival)) {}
+
+FolderWatcher::~FolderWatcher() {
+  if (fd >= 0) {
+    ::close(fd);
+  }
+}
+
+bool FolderWatcher::start() {
+  if (fd >= 0) {
+    return true;
+  }
+  fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) {
+    LOG(error) << "FolderWatcher: inotify is not available: " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool FolderWatcher::add(const std::string &folder) {
+  std::error_code ec;
+  fs::path root = fs::absolute(fs::u8path(folder), ec).lexically_normal();
+  if (ec || !fs::is_directory(root, ec)) {
+    LOG(error) << "FolderWatcher: " << folder << " is not a folder" << std::endl;
+    return false;
+  }
+  return watchTree(root.u8string(), false);
+}
+
+bool FolderWatcher::watchDir(const std::string &dir) {
+  int wd = inotify_add_watch(fd, dir.c_str(), kWatchMask);
+  if (wd < 0) {
+    LOG(error) << "FolderWatcher: Cannot watch " << dir << ": " << std::strerror(errno)
+               << (errno == ENOSPC ? ", raise fs.inotify.max_user_watches" : "") << std::endl;
+    return false;
+  }
+  dirs[wd] = dir; // a folder moved within the tree keeps its descriptor, only the path changes
+  return true;
+}
+
+// The folder is watched before it is listed, files that land while it is listed are seen twice and tracked once
+bool FolderWatcher::watchTree(const std::string &root, bool queueFiles) {
+  if (!watchDir(root)) {
+    return false;
+  }
+  bool ok = true;
+  std::error_code ec;
+  fs::recursive_directory_iterator it(fs::u8path(root), fs::directory_options::skip_permission_denied, ec);
+  for (; !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+    std::error_code typeEc;
+    if (it->is_directory(typeEc)) {
+      ok = watchDir(it->path().u8string()) && ok;
+    } else if (queueFiles && it->is_regular_file(typeEc)) {
+      track(it->path().u8string());
+    }
+  }
+  if (ec) {
+    LOG(warning) << "FolderWatcher: Cannot list " << root << ": " << ec.message() << std::endl;
+  }
+  return ok;
+}
+
+void FolderWatcher::track(const std::string &file) {
+  if (!wanted(file)) {
+    return;
+  }
+  std::error_code ec;
+  uintmax_t size = fs::file_size(fs::u8path(file), ec);
+  pending[file] = {Clock::now() + settle, ec ? 0 : size};
+}
+
+void FolderWatcher::readEvents() {
+  alignas(inotify_event) char buffer[64 * 1024];
+  for (;;) {
+    ssize_t len = ::read(fd, buffer, sizeof(buffer));
+    if (len <= 0) {
+      if (len < 0 && errno != EAGAIN && errno != EINTR) {
+        LOG(error) << "FolderWatcher: Cannot read events: " << std::strerror(errno) << std::endl;
+      }
+      return;
+    }
+    for (char *ptr = buffer; ptr < buffer + len;) {
+      auto *event = reinterpret_cast<inotify_event *>(ptr);
+      ptr += sizeof(inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        LOG(warning) << "FolderWatcher: Event queue overflowed, files that landed meanwhile may be missed. "
+                     << "Raise fs.inotify.max_queued_events" << std::endl;
+        continue;
+      }
+      if (event->mask & IN_IGNORED) {
+        dirs.erase(event->wd);
+        continue;
+      }
+      auto dir = dirs.find(event->wd);
+      if (dir == dirs.end() || event->len == 0) {
+        continue;
+      }
+      std::string path = dir->second + "/" + event->name;
+
+      if (event->mask & IN_ISDIR) {
+        if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+          LOG(debug) << "FolderWatcher: New folder " << path << std::endl;
+          watchTree(path, true);
+        }
+      } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+        track(path);
+      } else if (event->mask & IN_MODIFY) {
+        auto it = pending.find(path);
+        if (it != pending.end()) {
+          it->second.deadline = Clock::now() + settle; // written again, start over
+        }
+      }
+    }
+  }
+}
+
+void FolderWatcher::release() {
+  Clock::time_point now = Clock::now();
+  for (auto it = pending.begin(); it != pending.end();) {
+    if (it->second.deadline > now) {
+      ++it;
+      continue;
+    }
+    std::error_code ec;
+    uintmax_t size = fs::file_size(fs::u8path(it->first), ec);
+    if (ec) {
+      LOG(debug) << "FolderWatcher: " << it->first << " is gone" << std::endl;
+      it = pending.erase(it);
+    } else if (size != it->second.size) {
+      it->second = {now + settle, size}; // grew without a write event we saw, e.g. over a network share
+      ++it;
+    } else {
+      std::string file = it->first;
+      it = pending.erase(it);
+      arrival(file);
+    }
+  }
+}
+
+int FolderWatcher::timeout() const {
+  Clock::time_point now = Clock::now();
+  auto wait = std::chrono::milliseconds(kMaxWaitMs);
+  for (const auto &[file, entry] : pending) {
+    auto left = std::chrono::ceil<std::chrono::milliseconds>(entry.deadline - now);
+    wait = std::min(wait, std::max(left, std::chrono::milliseconds(0)));
+  }
+  return static_cast<int>(wait.count());
+}
+
+void FolderWatcher::run(const std::atomic<bool> &stop) {
+  while (!stop) {
+    pollfd pfd{fd, POLLIN, 0};
+    int ret = ::poll(&pfd, 1, timeout());
+    if (ret < 0 && errno != EINTR) {
+      LOG(error) << "FolderWatcher: poll failed: " << std::strerror(errno) << std::endl;
+      return;
+    }
+    if (ret > 0) {
+      readEvents();
+    }
+    release();
+  }
+  if (!pending.empty()) {
+    LOG(warning) << "FolderWatcher: " << pending.size() << " files were still settling and are not processed"
+                 << std::endl;
+  }
+}
+
+#else // !__linux__
+
+FolderWatcher::FolderWatcher(std::chrono::milliseconds settle, Filter wanted, Arrival arrival)
+    : settle(settle), wanted(std::move(wanted)), arrival(std::move(arrival)) {}
+
+FolderWatcher::~FolderWatcher() = default;
+
+bool FolderWatcher::start() {
+  LOG(error) << "FolderWatcher: watch folders need inotify, only available on Linux" << std::endl;
+  return false;
+}
+
+bool FolderWatcher::add(const std::string &folder) { return false; }
+
+void FolderWatcher::run(const std::atomic<bool> &stop) {}
+
+bool FolderWatcher::watchTree(const std::string &root, bool queueFiles) { return false; }
+
+bool FolderWatcher::watchDir(const std::string &dir) { return false; }
+
+void FolderWatcher::track(const std::string &file) {}
+
+void FolderWatcher::readEvents() {}
+
+void FolderWatcher::release() {}
+
+int FolderWatcher::timeout() const { return 0; }
+
+#endif
@@ -16,36 +16,29 @@
  */
 #pragma once
 
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+
 #include "unrawer/imageio.hpp"
 #include "unrawer/log.hpp"
+#include "unrawer/parallel.hpp"
 #include "unrawer/settings.hpp"
 
-int hue = 186;
-// void pbar_color_rand(QProgressBar* progressBar) {
-void pbar_color_rand(MainWindow *mainWindow) {
-  hue = (hue + 45) % 360;
-  int saturation = 250; // Set saturation value
-  int value = 205;      // Set value
-
-  QColor color;
-  color.setHsv(hue, saturation, value);
-
-  // setPBarColor(progressBar, color.name());
-  emit mainWindow->changeProgressBarColorSignal(color);
-}
-
-bool m_progress_callback(void *opaque_data, float portion_done) {
-  // Cast the opaque_data back to a QProgressBar
-  QProgressBar *progressBar = static_cast<QProgressBar *>(opaque_data);
-
-  int value = static_cast<int>(portion_done * 100);
-
-  // You need to use QMetaObject::invokeMethod when you are interacting with the GUI thread from a non-GUI thread
-  // Qt::QueuedConnection ensures the change will be made when control returns to the event loop of the GUI thread
-  QMetaObject::invokeMethod(progressBar, "setValue", Qt::QueuedConnection, Q_ARG(int, value));
-
-  return (portion_done >= 1.f);
-}
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 // settings.bitDepth to OIIO::TypeDesc
 TypeDesc getTypeDesc(int bit_depth) {
@@ -143,7 +136,7 @@ void debugImageBufWrite(const ImageBuf &buf, const std::string &filename) {
   }
 }
 
-bool thumb_load(ImageBuf &outBuf, const std::string inputFileName, MainWindow *mainWindow) {
+bool thumb_load(ImageBuf &outBuf, const std::string inputFileName) {
 
   LibRaw raw_processor;
   libraw_processed_image_t *thumb;
@@ -181,7 +174,7 @@ bool thumb_load(ImageBuf &outBuf, const std::string inputFileName, MainWindow *m
 }
 
 std::pair<bool, std::pair<std::shared_ptr<ImageBuf>, TypeDesc>>
-img_load(const std::string &inputFileName, QProgressBar *progressBar, MainWindow *mainWindow) {
+img_load(const std::string &inputFileName) {
   TypeDesc out_format;
 
   LOG(info) << "READ: " << inputFileName << std::endl;
@@ -217,7 +210,6 @@ img_load(const std::string &inputFileName, QProgressBar *progressBar, MainWindow
   if (!outBuf.init_spec(inputFileName, 0, 0)) {
     LOG(error) << "READ: Error reading " << inputFileName << std::endl;
     LOG(error) << "READ: " << outBuf.geterror() << std::endl;
-    mainWindow->emitUpdateTextSignal("Error! Check console for details");
     return {false, {std::make_shared<OIIO::ImageBuf>(), TypeDesc::UNKNOWN}};
   }
 
@@ -261,10 +253,9 @@ img_load(const std::string &inputFileName, QProgressBar *progressBar, MainWindow
   //     return false;
   // }
 
-  bool read_ok = outBuf.read(0, 0, 0, last_channel, true, o_format, m_progress_callback, progressBar);
+  bool read_ok = outBuf.read(0, 0, 0, last_channel, true, o_format);
   if (!read_ok) {
     LOG(error) << "READ: Error! Could not read input image\n";
-    mainWindow->emitUpdateTextSignal("Error! Check console for details");
     return {false, {std::make_shared<OIIO::ImageBuf>(), TypeDesc::UNKNOWN}};
   }
 
@@ -289,19 +280,148 @@ img_load(const std::string &inputFileName, QProgressBar *progressBar, MainWindow
   LOG(info) << "READ: Channels: " << outBuf.nchannels() << " Alpha channel index: " << outBuf.spec().alpha_channel
             << std::endl;
 
-  return {true, {std::make_shared<OIIO::ImageBuf>(outBuf), orig_format}};
+  return {true, {std::make_shared<OIIO::ImageBuf>(std::move(outBuf)), orig_format}};
 }
 
 bool makePath(const std::string &out_path) { return true; }
 
+static constexpr const char *kPartialMarker = ".partial";
+
+static unsigned long processId() {
+#ifdef _WIN32
+  return GetCurrentProcessId();
+#else
+  return static_cast<unsigned long>(getpid());
+#endif
+}
+
+// Host name reduced to letters, digits and '_', it never contains the '.' and '-' separators of the writer id
+static const std::string &hostTag() {
+  static const std::string tag = [] {
+    char name[256] = {};
+#ifdef _WIN32
+    DWORD size = sizeof(name);
+    if (!GetComputerNameA(name, &size)) {
+      name[0] = '\0';
+    }
+#else
+    if (gethostname(name, sizeof(name) - 1) != 0) {
+      name[0] = '\0';
+    }
+#endif
+    std::string tag;
+    for (const char *c = name; *c; ++c) {
+      bool alnum = (*c >= '0' && *c <= '9') || (*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z');
+      tag += alnum ? *c : '_';
+    }
+    return tag.empty() ? std::string("host") : tag;
+  }();
+  return tag;
+}
+
+// false only when the process is known to be gone, a process we may not signal still runs
+static bool processAlive(unsigned long pid) {
+#ifdef _WIN32
+  HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, static_cast<DWORD>(pid));
+  if (process == nullptr) {
+    return GetLastError() == ERROR_ACCESS_DENIED;
+  }
+  DWORD code = 0;
+  bool alive = GetExitCodeProcess(process, &code) && code == STILL_ACTIVE;
+  CloseHandle(process);
+  return alive;
+#else
+  return ::kill(static_cast<pid_t>(pid), 0) == 0 || errno == EPERM;
+#endif
+}
+
+// ".<stem>.<host>-<pid>.partial<ext>": the writer is part of the name so a sweep never takes a file another live
+// process, on this machine or another one sharing the folder, is still writing
+std::string partialPath(const std::string &path) {
+  std::filesystem::path file = std::filesystem::u8path(path);
+  std::string name = "." + file.stem().u8string() + "." + hostTag() + "-" + std::to_string(processId()) +
+                     kPartialMarker + file.extension().u8string();
+  return (file.parent_path() / std::filesystem::u8path(name)).u8string();
+}
+
+#ifndef _WIN32
+static void syncPath(const std::string &path, int flags) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | flags);
+  if (fd >= 0) {
+    ::fsync(fd);
+    ::close(fd);
+  }
+}
+#endif
+
+bool commitOutput(const std::string &partial, const std::string &path) {
+#ifndef _WIN32
+  syncPath(partial, 0); // the data reaches the disk before the name does
+#endif
+  std::error_code ec;
+  std::filesystem::rename(std::filesystem::u8path(partial), std::filesystem::u8path(path), ec);
+  if (ec) {
+    LOG(error) << "Cannot move " << partial << " to " << path << ": " << ec.message() << std::endl;
+    discardOutput(partial);
+    return false;
+  }
+#ifndef _WIN32
+  syncPath(std::filesystem::u8path(path).parent_path().u8string(), O_DIRECTORY);
+#endif
+  return true;
+}
+
+void discardOutput(const std::string &partial) {
+  std::error_code ec;
+  std::filesystem::remove(std::filesystem::u8path(partial), ec);
+}
+
+// Stale when written on this host by a process that is gone, partials of other hosts are left to their own sweeps
+static bool stalePartial(const std::filesystem::directory_entry &entry) {
+  const std::string marker = kPartialMarker;
+  std::string stem = entry.path().stem().u8string();
+  if (stem.size() <= marker.size() + 1 || stem[0] != '.' ||
+      stem.compare(stem.size() - marker.size(), marker.size(), marker) != 0) {
+    return false;
+  }
+  std::string writer = stem.substr(0, stem.size() - marker.size());
+  writer = writer.substr(writer.rfind('.') + 1); // <host>-<pid>
+  size_t dash = writer.rfind('-');
+  size_t digits = dash == std::string::npos ? 0 : writer.size() - dash - 1;
+  if (digits == 0 || digits > 10 || writer.compare(0, dash, hostTag()) != 0 ||
+      writer.find_first_not_of("0123456789", dash + 1) != std::string::npos) {
+    return false;
+  }
+  unsigned long pid = std::stoul(writer.substr(dash + 1));
+  std::error_code ec;
+  // Our own partials are in flight. File times are too coarse to tell them from those of an earlier process that
+  // had the same pid, those few are left behind.
+  return entry.is_regular_file(ec) && pid != processId() && !processAlive(pid);
+}
+
+void sweepPartials(const std::string &dir) {
+  namespace fs = std::filesystem;
+  std::error_code ec;
+  size_t removed = 0;
+  for (fs::directory_iterator it(fs::u8path(dir), ec), end; !ec && it != end; it.increment(ec)) {
+    std::error_code fileEc;
+    if (stalePartial(*it) && fs::remove(it->path(), fileEc)) {
+      ++removed;
+    }
+  }
+  if (removed > 0) {
+    LOG(info) << "Removed " << removed << " partial files of an interrupted batch from " << dir << std::endl;
+  }
+}
+
 bool img_write(std::shared_ptr<ImageBuf> out_buf,
                const std::string &outputFileName,
                TypeDesc out_format,
                TypeDesc orig_format,
-               QProgressBar *progressBar,
-               MainWindow *mainWindow) {
+               size_t *bytesCopied) {
 
-  ImageSpec &ospec = out_buf->specmod();
+  // A copy: the buffer keeps describing its own pixels, the output format is set on the file only
+  ImageSpec ospec = out_buf->spec();
 
   // rspec.attribute("oiio:BitsPerSample", bits);
   /*
@@ -337,22 +457,42 @@ bool img_write(std::shared_ptr<ImageBuf> out_buf,
   auto out = ImageOutput::create(outputFileName);
   if (!out) {
     LOG(error) << "Could not create output file: " << outputFileName << std::endl;
-    mainWindow->emitUpdateTextSignal("Error! Check console for details");
     return false;
   }
-  out->open(outputFileName, ospec, ImageOutput::Create);
-
-  QMetaObject::invokeMethod(progressBar, "setValue", Qt::QueuedConnection, Q_ARG(int, 0));
+  if (!out->open(outputFileName, ospec, ImageOutput::Create)) {
+    LOG(error) << "Could not open output file: " << outputFileName << ": " << out->geterror() << std::endl;
+    return false;
+  }
 
   LOG(info) << "Writing " << outputFileName << std::endl;
 
-  auto ou_px = out_buf->localpixels();
-  auto ou_pst = out_buf->pixel_stride();
-  auto ou_bst = out_buf->scanline_stride();
-  auto ou_zst = out_buf->z_stride();
+  // Pixels are handed to the writer as `out_format`. Buffers in another format are converted first, in strips over
+  // the workers, instead of scanline by scanline on this thread inside the format plugin.
+  const ImageBuf *pixels = out_buf.get();
+  ImageBuf converted;
+  if (out_format != TypeDesc::UNKNOWN && out_buf->spec().format != out_format && out_buf->localpixels() != nullptr) {
+    ImageSpec cspec = out_buf->spec();
+    cspec.set_format(out_format);
+    converted.reset(cspec);
+    parallelRows(out_buf->roi(), [&](ROI roi) { ImageBufAlgo::copy(converted, *out_buf, TypeUnknown, roi, 1); });
+    pixels = &converted;
+    if (bytesCopied) {
+      *bytesCopied += cspec.image_bytes();
+    }
+  }
+
+  auto ou_px = pixels->localpixels();
+  auto ou_pst = pixels->pixel_stride();
+  auto ou_bst = pixels->scanline_stride();
+  auto ou_zst = pixels->z_stride();
 
-  out->write_image(out_format, ou_px, ou_pst, ou_bst, ou_zst, *m_progress_callback, progressBar);
-  out->close();
+  // A full disk or a failing share must not pass as a written file
+  bool write_ok = out->write_image(out_format, ou_px, ou_pst, ou_bst, ou_zst);
+  bool close_ok = out->close();
+  if (!write_ok || !close_ok) {
+    LOG(error) << "Could not write output file: " << outputFileName << ": " << out->geterror() << std::endl;
+    return false;
+  }
   return true;
 }
 
@@ -0,0 +1,107 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstdio>
+#include <filesystem>
+#include <system_error>
+
+#include "unrawer/journal.hpp"
+#include "unrawer/log.hpp"
+#include "unrawer/manifest.hpp"
+#include "unrawer/settings.hpp"
+
+namespace fs = std::filesystem;
+
+static constexpr const char *kHeader = "# unrawer journal 1";
+
+// The same file reached through another relative path or a symlinked folder is still the same entry
+std::string BatchJournal::key(const std::string &srcFile) {
+  std::error_code ec;
+  fs::path canonical = fs::weakly_canonical(fs::u8path(srcFile), ec);
+  return ec ? srcFile : canonical.u8string();
+}
+
+// "settings <fingerprint>" after the header, then "done <file>" or "failed <file>" per finished file, tab
+// separated. Later lines supersede earlier ones for the same file, a torn last line is ignored.
+bool BatchJournal::open(const std::string &path, bool resume) {
+  char settingsLine[32];
+  std::snprintf(settingsLine, sizeof(settingsLine), "settings\t%016llx",
+                static_cast<unsigned long long>(settingsFingerprint(settings, "")));
+
+  done.clear();
+  std::error_code ec;
+  bool append = resume && fs::exists(fs::u8path(path), ec);
+  if (append) {
+    std::ifstream in(fs::u8path(path));
+    std::string line;
+    bool empty = !std::getline(in, line);
+    if (!empty && line != kHeader) {
+      LOG(error) << "Journal: " << path << " is not an unrawer journal" << std::endl;
+      return false;
+    }
+    if (empty) {
+      append = false; // created by a run that stopped before writing anything
+    } else if (std::getline(in, line) && line == settingsLine) {
+      for (std::streamoff complete = in.tellg(); std::getline(in, line); complete = in.tellg()) {
+        if (in.eof()) {
+          // A crash cut the last line short, it is dropped so the next record starts on a line of its own
+          in.close();
+          fs::resize_file(fs::u8path(path), static_cast<uintmax_t>(complete), ec);
+          break;
+        }
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos) {
+          continue;
+        }
+        std::string file = line.substr(tab + 1);
+        if (line.compare(0, tab, "done") == 0) {
+          done.insert(file);
+        } else if (line.compare(0, tab, "failed") == 0) {
+          done.erase(file);
+        }
+      }
+      LOG(info) << "Journal: Resuming, " << done.size() << " files already done" << std::endl;
+    } else {
+      LOG(warning) << "Journal: Settings changed since " << path << " was started, processing every file again"
+                   << std::endl;
+      append = false;
+    }
+  }
+
+  out.open(fs::u8path(path), append ? std::ios::app : std::ios::trunc);
+  if (!append) {
+    out << kHeader << "\n" << settingsLine << "\n";
+  }
+  out.flush();
+  if (!out) {
+    LOG(error) << "Journal: Cannot write " << path << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool BatchJournal::completed(const std::string &srcFile) const {
+  return !done.empty() && done.count(key(srcFile)) > 0;
+}
+
+void BatchJournal::record(const std::string &srcFile, bool ok) {
+  std::string line = (ok ? "done\t" : "failed\t") + key(srcFile) + "\n";
+  std::lock_guard<std::mutex> lock(mtx);
+  out << line;
+  out.flush(); // in the kernel before the next file finishes, a crash of the process cannot lose it
+}
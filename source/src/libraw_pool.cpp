@@ -0,0 +1,74 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "unrawer/libraw_pool.hpp"
+#include "unrawer/log.hpp"
+#include "unrawer/scheduler.hpp"
+
+#include <algorithm>
+
+LibRawPool::LibRawPool(size_t slots, size_t perSlot) : perSlot(std::max<size_t>(1, perSlot)) {
+  for (size_t i = 0; i < slots + 1; ++i) {
+    this->slots.push_back(std::make_unique<Slot>());
+  }
+}
+
+LibRawPool::~LibRawPool() {
+  for (auto &slot : slots) {
+    for (LibRaw *raw : slot->free) {
+      delete raw;
+    }
+  }
+  LOG(debug) << "LibRawPool: " << made << " processors created, " << hits << " reused" << std::endl;
+}
+
+LibRawPool::Slot &LibRawPool::slotOf(size_t worker) { return *slots[std::min(worker, slots.size() - 1)]; }
+
+std::shared_ptr<LibRaw> LibRawPool::acquire() {
+  size_t self = Scheduler::currentWorker();
+  LibRaw *raw = nullptr;
+  // Own slot first, then any other
+  for (size_t i = 0; i < slots.size() && raw == nullptr; ++i) {
+    Slot &slot = slotOf(i == 0 ? self : (std::min(self, slots.size() - 1) + i) % slots.size());
+    std::lock_guard<std::mutex> lock(slot.mtx);
+    if (!slot.free.empty()) {
+      raw = slot.free.back();
+      slot.free.pop_back();
+    }
+  }
+  if (raw) {
+    ++hits;
+  } else {
+    raw = new LibRaw();
+    ++made;
+  }
+  return std::shared_ptr<LibRaw>(raw, [this](LibRaw *raw) { release(raw); });
+}
+
+// Runs where the last reference is dropped, usually the writer of the file on the worker that read it
+void LibRawPool::release(LibRaw *raw) {
+  raw->recycle(); // frees the image buffers and closes the input, the processor itself stays allocated
+  Slot &slot = slotOf(Scheduler::currentWorker());
+  {
+    std::lock_guard<std::mutex> lock(slot.mtx);
+    if (slot.free.size() < perSlot) {
+      slot.free.push_back(raw);
+      return;
+    }
+  }
+  delete raw;
+}
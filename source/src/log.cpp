@@ -36,9 +36,9 @@ std::string format_thread_id(attrs::current_thread_id::value_type::native_type i
 }
 
 // TODO: Make into a class with enhancements maybe?
-void Log_Init() {
+void Log_Init(std::ostream &stream) {
   boost::log::add_common_attributes();
-  boost::log::add_console_log(std::cout, boost::log::keywords::format = "[%Severity%]<%ThreadID%> %Message%"
+  boost::log::add_console_log(stream, boost::log::keywords::format = "[%Severity%]<%ThreadID%> %Message%"
                               // boost::log::keywords::format = "[%TimeStamp%] [%Severity%] %File%(%Line%): %Message%"
   );
 }
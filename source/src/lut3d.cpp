@@ -0,0 +1,346 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+
+#include "unrawer/log.hpp"
+#include "unrawer/lut3d.hpp"
+#include "unrawer/parallel.hpp"
+#include "unrawer/simd.hpp"
+
+// Pixels converted to planar floats and interpolated in one go
+static constexpr size_t kChunk = 256;
+
+#if defined(UNRAWER_SIMD_X86)
+// 8 pixels per step, the 4 vertices of each pixel's tetrahedron are gathered per channel
+UNRAWER_TARGET_AVX2 static size_t interpolateAVX2(
+    const float *table, int n, float *r, float *g, float *b, size_t count) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 last = _mm256_set1_ps(static_cast<float>(n - 1));
+  const __m256i maxBase = _mm256_set1_epi32(n - 2);
+  const __m256i dR = _mm256_set1_epi32(4), dG = _mm256_set1_epi32(4 * n), dB = _mm256_set1_epi32(4 * n * n);
+  const __m256i dAll = _mm256_add_epi32(dR, _mm256_add_epi32(dG, dB));
+
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256 x = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(r + i), zero), last);
+    __m256 y = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(g + i), zero), last);
+    __m256 z = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(b + i), zero), last);
+    __m256i ix = _mm256_min_epi32(_mm256_cvttps_epi32(x), maxBase);
+    __m256i iy = _mm256_min_epi32(_mm256_cvttps_epi32(y), maxBase);
+    __m256i iz = _mm256_min_epi32(_mm256_cvttps_epi32(z), maxBase);
+    __m256 fr = _mm256_sub_ps(x, _mm256_cvtepi32_ps(ix));
+    __m256 fg = _mm256_sub_ps(y, _mm256_cvtepi32_ps(iy));
+    __m256 fb = _mm256_sub_ps(z, _mm256_cvtepi32_ps(iz));
+
+    __m256i base = _mm256_add_epi32(_mm256_mullo_epi32(ix, dR),
+                                    _mm256_add_epi32(_mm256_mullo_epi32(iy, dG), _mm256_mullo_epi32(iz, dB)));
+
+    // Largest fraction picks the first step, ties r > g > b. Smallest picks the axis left out of the second step,
+    // ties b > g > r, so the two never coincide.
+    __m256 rMax = _mm256_and_ps(_mm256_cmp_ps(fr, fg, _CMP_GE_OQ), _mm256_cmp_ps(fr, fb, _CMP_GE_OQ));
+    __m256 gMax = _mm256_andnot_ps(rMax, _mm256_cmp_ps(fg, fb, _CMP_GE_OQ));
+    __m256 bMin = _mm256_and_ps(_mm256_cmp_ps(fb, fg, _CMP_LE_OQ), _mm256_cmp_ps(fb, fr, _CMP_LE_OQ));
+    __m256 gMin = _mm256_andnot_ps(bMin, _mm256_cmp_ps(fg, fr, _CMP_LE_OQ));
+    __m256i off1 = _mm256_castps_si256(_mm256_blendv_ps(
+        _mm256_blendv_ps(_mm256_castsi256_ps(dB), _mm256_castsi256_ps(dG), gMax), _mm256_castsi256_ps(dR), rMax));
+    __m256i offMin = _mm256_castps_si256(_mm256_blendv_ps(
+        _mm256_blendv_ps(_mm256_castsi256_ps(dR), _mm256_castsi256_ps(dG), gMin), _mm256_castsi256_ps(dB), bMin));
+    __m256i off2 = _mm256_sub_epi32(dAll, offMin);
+
+    __m256 fMax = _mm256_max_ps(fr, _mm256_max_ps(fg, fb));
+    __m256 fMin = _mm256_min_ps(fr, _mm256_min_ps(fg, fb));
+    __m256 fMid = _mm256_sub_ps(_mm256_add_ps(fr, _mm256_add_ps(fg, fb)), _mm256_add_ps(fMax, fMin));
+    __m256 w0 = _mm256_sub_ps(one, fMax);
+    __m256 w1 = _mm256_sub_ps(fMax, fMid);
+    __m256 w2 = _mm256_sub_ps(fMid, fMin);
+
+    __m256i v1 = _mm256_add_epi32(base, off1);
+    __m256i v2 = _mm256_add_epi32(base, off2);
+    __m256i v3 = _mm256_add_epi32(base, dAll);
+    float *out[3] = {r + i, g + i, b + i};
+    for (int c = 0; c < 3; ++c) {
+      const float *t = table + c;
+      __m256 acc = _mm256_mul_ps(_mm256_i32gather_ps(t, base, 4), w0);
+      acc = _mm256_fmadd_ps(_mm256_i32gather_ps(t, v1, 4), w1, acc);
+      acc = _mm256_fmadd_ps(_mm256_i32gather_ps(t, v2, 4), w2, acc);
+      acc = _mm256_fmadd_ps(_mm256_i32gather_ps(t, v3, 4), fMin, acc);
+      _mm256_storeu_ps(out[c], acc);
+    }
+  }
+  return i;
+}
+#endif
+
+// Clamps to [0, hi] and maps NaN to 0 like max_ps does in the AVX2 path, std::clamp passes NaN through and the
+// integer conversion of NaN is undefined
+static inline float clampSample(float v, float hi) { return v > 0.0f ? std::min(v, hi) : 0.0f; }
+
+void Lut3D::interpolate(float *r, float *g, float *b, size_t count) const {
+  size_t i = 0;
+#if defined(UNRAWER_SIMD_X86)
+  if (cpuHasAVX2()) {
+    i = interpolateAVX2(table.data(), n, r, g, b, count);
+  }
+#endif
+  const float last = static_cast<float>(n - 1);
+  const size_t dR = 4, dG = 4 * static_cast<size_t>(n), dB = dG * n, dAll = dR + dG + dB;
+  for (; i < count; ++i) {
+    float x = clampSample(r[i], last), y = clampSample(g[i], last), z = clampSample(b[i], last);
+    int ix = std::min(static_cast<int>(x), n - 2), iy = std::min(static_cast<int>(y), n - 2),
+        iz = std::min(static_cast<int>(z), n - 2);
+    float fr = x - ix, fg = y - iy, fb = z - iz;
+
+    bool rMax = fr >= fg && fr >= fb, gMax = !rMax && fg >= fb;
+    bool bMin = fb <= fg && fb <= fr, gMin = !bMin && fg <= fr;
+    size_t off1 = rMax ? dR : (gMax ? dG : dB);
+    size_t off2 = dAll - (bMin ? dB : (gMin ? dG : dR));
+    float fMax = std::max(fr, std::max(fg, fb)), fMin = std::min(fr, std::min(fg, fb));
+    float fMid = fr + fg + fb - fMax - fMin;
+    float w0 = 1.0f - fMax, w1 = fMax - fMid, w2 = fMid - fMin;
+
+    const float *c0 = table.data() + ix * dR + iy * dG + iz * dB;
+#if defined(UNRAWER_SIMD_X86)
+    __m128 acc = _mm_mul_ps(_mm_loadu_ps(c0), _mm_set1_ps(w0));
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(c0 + off1), _mm_set1_ps(w1)));
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(c0 + off2), _mm_set1_ps(w2)));
+    acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(c0 + dAll), _mm_set1_ps(fMin)));
+    alignas(16) float rgb[4];
+    _mm_store_ps(rgb, acc);
+#elif defined(UNRAWER_SIMD_NEON)
+    float32x4_t acc = vmulq_n_f32(vld1q_f32(c0), w0);
+    acc = vmlaq_n_f32(acc, vld1q_f32(c0 + off1), w1);
+    acc = vmlaq_n_f32(acc, vld1q_f32(c0 + off2), w2);
+    acc = vmlaq_n_f32(acc, vld1q_f32(c0 + dAll), fMin);
+    float rgb[4];
+    vst1q_f32(rgb, acc);
+#else
+    float rgb[3];
+    for (int c = 0; c < 3; ++c) {
+      rgb[c] = c0[c] * w0 + c0[off1 + c] * w1 + c0[off2 + c] * w2 + c0[dAll + c] * fMin;
+    }
+#endif
+    r[i] = rgb[0];
+    g[i] = rgb[1];
+    b[i] = rgb[2];
+  }
+}
+
+// Normalised sample values: uint16 maps to [0, 1] like OCIO does, float passes through
+template <class T> struct Sample;
+template <> struct Sample<uint16_t> {
+  static float load(uint16_t v) { return v * (1.0f / 65535.0f); }
+  static uint16_t store(float v) { return static_cast<uint16_t>(clampSample(v, 1.0f) * 65535.0f + 0.5f); }
+};
+template <> struct Sample<float> {
+  static float load(float v) { return v; }
+  static float store(float v) { return v; }
+};
+
+template <class T> void Lut3D::applyRows(const OIIO::ImageBuf &src, OIIO::ImageBuf &dst, int ybegin, int yend) const {
+  const OIIO::ImageSpec &spec = src.spec();
+  const int nch = spec.nchannels;
+  const size_t width = static_cast<size_t>(spec.width);
+  float scale[3], offset[3];
+  for (int c = 0; c < 3; ++c) {
+    scale[c] = (n - 1) / (domainMax[c] - domainMin[c]);
+    offset[c] = -domainMin[c] * scale[c];
+  }
+
+  alignas(32) float r[kChunk], g[kChunk], b[kChunk];
+  for (int y = ybegin; y < yend; ++y) {
+    const T *in = static_cast<const T *>(src.pixeladdr(spec.x, y, spec.z));
+    T *out = static_cast<T *>(dst.pixeladdr(spec.x, y, spec.z));
+    for (size_t x0 = 0; x0 < width; x0 += kChunk) {
+      size_t count = std::min(kChunk, width - x0);
+      const T *p = in + x0 * nch;
+      for (size_t i = 0; i < count; ++i, p += nch) {
+        r[i] = Sample<T>::load(p[0]) * scale[0] + offset[0];
+        g[i] = Sample<T>::load(p[1]) * scale[1] + offset[1];
+        b[i] = Sample<T>::load(p[2]) * scale[2] + offset[2];
+      }
+      interpolate(r, g, b, count);
+      T *q = out + x0 * nch;
+      p = in + x0 * nch;
+      for (size_t i = 0; i < count; ++i, p += nch, q += nch) {
+        q[0] = Sample<T>::store(r[i]);
+        q[1] = Sample<T>::store(g[i]);
+        q[2] = Sample<T>::store(b[i]);
+        if (q != p) {
+          std::copy(p + 3, p + nch, q + 3); // alpha and extra channels pass through
+        }
+      }
+    }
+  }
+}
+
+void Lut3D::applyFloat(float *pixels, size_t count, int nchannels) const {
+  float scale[3], offset[3];
+  for (int c = 0; c < 3; ++c) {
+    scale[c] = (n - 1) / (domainMax[c] - domainMin[c]);
+    offset[c] = -domainMin[c] * scale[c];
+  }
+
+  alignas(32) float r[kChunk], g[kChunk], b[kChunk];
+  for (size_t x0 = 0; x0 < count; x0 += kChunk) {
+    size_t chunk = std::min(kChunk, count - x0);
+    float *p = pixels + x0 * nchannels;
+    for (size_t i = 0; i < chunk; ++i, p += nchannels) {
+      r[i] = p[0] * scale[0] + offset[0];
+      g[i] = p[1] * scale[1] + offset[1];
+      b[i] = p[2] * scale[2] + offset[2];
+    }
+    interpolate(r, g, b, chunk);
+    p = pixels + x0 * nchannels;
+    for (size_t i = 0; i < chunk; ++i, p += nchannels) {
+      p[0] = r[i];
+      p[1] = g[i];
+      p[2] = b[i];
+    }
+  }
+}
+
+bool Lut3D::apply(OIIO::ImageBuf &dst, const OIIO::ImageBuf &src) const {
+  const OIIO::ImageSpec &spec = src.spec();
+  bool uint16 = spec.format == OIIO::TypeDesc::UINT16;
+  if (src.localpixels() == nullptr || spec.nchannels < 3 || (!uint16 && spec.format != OIIO::TypeDesc::FLOAT)) {
+    return false;
+  }
+  if (&dst != &src) {
+    if (!dst.initialized()) {
+      dst.reset(spec);
+    }
+    const OIIO::ImageSpec &dspec = dst.spec();
+    if (dst.localpixels() == nullptr || dspec.format != spec.format || dspec.nchannels != spec.nchannels ||
+        dspec.width != spec.width || dspec.height != spec.height) {
+      return false;
+    }
+  }
+
+  parallelRows(src.roi(), [&](OIIO::ROI roi) {
+    if (uint16) {
+      applyRows<uint16_t>(src, dst, roi.ybegin, roi.yend);
+    } else {
+      applyRows<float>(src, dst, roi.ybegin, roi.yend);
+    }
+  });
+  return true;
+}
+
+std::shared_ptr<const Lut3D> Lut3D::load(const std::string &path) {
+  std::ifstream file(path);
+  if (!file) {
+    LOG(error) << "LUT: Cannot open " << path << std::endl;
+    return nullptr;
+  }
+
+  auto lut = std::make_shared<Lut3D>();
+  size_t entries = 0, filled = 0;
+  std::string line;
+  while (std::getline(file, line)) {
+    size_t start = line.find_first_not_of(" \t\r");
+    if (start == std::string::npos || line[start] == '#') {
+      continue;
+    }
+    std::istringstream fields(line.substr(start));
+    if (std::isdigit(static_cast<unsigned char>(line[start])) || line[start] == '-' || line[start] == '.') {
+      if (entries == 0 || filled == entries) {
+        LOG(error) << "LUT: Unexpected data in " << path << std::endl;
+        return nullptr;
+      }
+      float *entry = lut->table.data() + filled * 4;
+      if (!(fields >> entry[0] >> entry[1] >> entry[2])) {
+        LOG(error) << "LUT: Bad entry " << filled << " in " << path << std::endl;
+        return nullptr;
+      }
+      ++filled;
+      continue;
+    }
+
+    std::string key;
+    fields >> key;
+    if (key == "LUT_3D_SIZE") {
+      fields >> lut->n;
+      if (lut->n < 2 || lut->n > 256 || entries != 0) {
+        LOG(error) << "LUT: Unsupported 3D size in " << path << std::endl;
+        return nullptr;
+      }
+      entries = static_cast<size_t>(lut->n) * lut->n * lut->n;
+      lut->table.assign(entries * 4, 0.0f);
+    } else if (key == "DOMAIN_MIN") {
+      fields >> lut->domainMin[0] >> lut->domainMin[1] >> lut->domainMin[2];
+    } else if (key == "DOMAIN_MAX") {
+      fields >> lut->domainMax[0] >> lut->domainMax[1] >> lut->domainMax[2];
+    } else if (key == "LUT_3D_INPUT_RANGE") {
+      float lo = 0.0f, hi = 1.0f;
+      fields >> lo >> hi;
+      std::fill(lut->domainMin, lut->domainMin + 3, lo);
+      std::fill(lut->domainMax, lut->domainMax + 3, hi);
+    } else if (key == "LUT_1D_SIZE" || key == "LUT_1D_INPUT_RANGE") {
+      LOG(debug) << "LUT: " << path << " has a 1D part, applied through OCIO" << std::endl;
+      return nullptr;
+    } else if (key != "TITLE") {
+      LOG(debug) << "LUT: " << path << " has an unknown keyword " << key << ", applied through OCIO" << std::endl;
+      return nullptr;
+    }
+  }
+
+  if (entries == 0 || filled != entries) {
+    LOG(error) << "LUT: " << path << " has " << filled << " of " << entries << " entries" << std::endl;
+    return nullptr;
+  }
+  for (int c = 0; c < 3; ++c) {
+    if (!(lut->domainMax[c] > lut->domainMin[c])) {
+      LOG(error) << "LUT: Empty domain in " << path << std::endl;
+      return nullptr;
+    }
+  }
+  LOG(info) << "LUT: Loaded " << lut->n << "^3 cube " << path << std::endl;
+  return lut;
+}
+
+std::shared_ptr<const Lut3D> LutCache::get(const std::string &path) {
+  std::string ext = std::filesystem::path(path).extension().string();
+  std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
+  if (ext != ".cube") {
+    return nullptr;
+  }
+  std::error_code ec;
+  auto mtime = std::filesystem::last_write_time(path, ec);
+  if (ec) {
+    return nullptr; // OCIO may still find it on its search path
+  }
+
+  std::lock_guard<std::mutex> lock(mtx);
+  auto it = luts.find(path);
+  if (it == luts.end() || it->second.mtime != mtime) {
+    // Parsed under the lock: workers hitting a new preset at once wait for the one parse instead of repeating it
+    it = luts.insert_or_assign(path, Entry{mtime, Lut3D::load(path)}).first;
+  }
+  return it->second.lut;
+}
+
+void LutCache::clear() {
+  std::lock_guard<std::mutex> lock(mtx);
+  luts.clear();
+}
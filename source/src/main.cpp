@@ -18,6 +18,7 @@
 #include <QtWidgets/QtWidgets>
 
 #include "unrawer/settings.hpp"
+#include "unrawer/ui.hpp"
 
 int main(int argc, char *argv[]) {
   HWND consoleWindow = GetConsoleWindow();
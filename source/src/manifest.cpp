@@ -0,0 +1,261 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <system_error>
+#include <vector>
+
+#include <OpenImageIO/hash.h>
+
+#include "unrawer/log.hpp"
+#include "unrawer/manifest.hpp"
+#include "unrawer/mapped_file.hpp"
+#include "unrawer/settings.hpp"
+#include "unrawer/unrawer.hpp"
+#include "unrawer/version.hpp"
+
+namespace fs = std::filesystem;
+
+static constexpr const char *kHeader = "# unrawer manifest 1";
+
+static bool sourceStamp(const std::string &srcFile, uintmax_t &size, int64_t &mtime) {
+  std::error_code ec;
+  fs::path src = fs::u8path(srcFile);
+  size = fs::file_size(src, ec);
+  if (ec) {
+    return false;
+  }
+  mtime = static_cast<int64_t>(fs::last_write_time(src, ec).time_since_epoch().count());
+  return !ec;
+}
+
+static std::string hex(uint64_t value) {
+  char text[17];
+  std::snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(value));
+  return text;
+}
+
+OutputManifest::Folder &OutputManifest::folder(const std::string &dir) {
+  std::lock_guard<std::mutex> lock(mtx);
+  std::unique_ptr<Folder> &entry = folders[dir];
+  if (!entry) {
+    entry = std::make_unique<Folder>();
+  }
+  return *entry;
+}
+
+// One line per written output: key, output, source size, source mtime, source hash, settings fingerprint.
+// Later lines supersede earlier ones for the same key, malformed lines are ignored.
+void OutputManifest::load(const std::string &dir, Folder &folder) {
+  folder.loaded = true;
+  fs::path path = fs::u8path(dir) / kFileName;
+  std::ifstream in(path);
+  if (!in) {
+    return;
+  }
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::vector<std::string> fields;
+    std::istringstream split(line);
+    for (std::string field; std::getline(split, field, '\t');) {
+      fields.push_back(field);
+    }
+    if (fields.size() != 6) {
+      continue;
+    }
+    try {
+      Entry entry{fields[1],
+                  std::stoull(fields[2]),
+                  std::stoll(fields[3]),
+                  std::stoull(fields[4], nullptr, 16),
+                  std::stoull(fields[5], nullptr, 16)};
+      folder.entries[fields[0]] = std::move(entry);
+      ++folder.lines;
+    } catch (const std::exception &) {
+      continue;
+    }
+  }
+  in.close();
+  LOG(debug) << "Manifest: " << folder.entries.size() << " outputs recorded in " << dir << std::endl;
+
+  // Rewritten once most lines are superseded, through a temporary file so a crash keeps the old one
+  if (folder.lines > 2 * folder.entries.size() + 64) {
+    fs::path tmp = path;
+    tmp += ".tmp";
+    std::ofstream out(tmp, std::ios::trunc);
+    out << kHeader << "\n";
+    for (const auto &[key, entry] : folder.entries) {
+      out << key << "\t" << entry.output << "\t" << entry.size << "\t" << entry.mtime << "\t" << hex(entry.hash)
+          << "\t" << hex(entry.settings) << "\n";
+    }
+    out.close();
+    std::error_code ec;
+    if (out) {
+      fs::rename(tmp, path, ec);
+    }
+    if (!out || ec) {
+      LOG(warning) << "Manifest: Cannot compact " << path.u8string() << std::endl;
+      fs::remove(tmp, ec);
+    } else {
+      folder.lines = folder.entries.size();
+    }
+  }
+}
+
+void OutputManifest::append(const std::string &dir, Folder &folder, const std::string &key, const Entry &entry) {
+  fs::path path = fs::u8path(dir) / kFileName;
+  std::error_code ec;
+  bool fresh = !fs::exists(path, ec);
+  std::ofstream out(path, std::ios::app);
+  if (fresh) {
+    out << kHeader << "\n";
+  }
+  out << key << "\t" << entry.output << "\t" << entry.size << "\t" << entry.mtime << "\t" << hex(entry.hash) << "\t"
+      << hex(entry.settings) << "\n";
+  out.close();
+  if (!out) {
+    LOG(warning) << "Manifest: Cannot update " << path.u8string() << std::endl;
+    return;
+  }
+  ++folder.lines;
+}
+
+bool OutputManifest::upToDate(const std::string &dir,
+                              const std::string &key,
+                              const std::string &srcFile,
+                              uint64_t settings) {
+  Folder &f = folder(dir);
+  Entry entry;
+  {
+    std::lock_guard<std::mutex> lock(f.mtx);
+    if (!f.loaded) {
+      load(dir, f);
+    }
+    auto it = f.entries.find(key);
+    if (it == f.entries.end()) {
+      return false;
+    }
+    entry = it->second;
+  }
+  if (entry.settings != settings) {
+    LOG(debug) << "Manifest: " << key << " was made with other settings" << std::endl;
+    return false;
+  }
+  std::error_code ec;
+  if (!fs::is_regular_file(fs::u8path(dir) / fs::u8path(entry.output), ec)) {
+    return false;
+  }
+  uintmax_t size;
+  int64_t mtime;
+  if (!sourceStamp(srcFile, size, mtime) || size != entry.size) {
+    return false;
+  }
+  if (mtime == entry.mtime) {
+    return true;
+  }
+
+  // Same size, new time: copied or touched. The contents decide, hashed outside the lock.
+  uint64_t hash = hashFile(srcFile);
+  if (hash == 0 || hash != entry.hash) {
+    return false;
+  }
+  entry.mtime = mtime;
+  std::lock_guard<std::mutex> lock(f.mtx);
+  f.entries[key] = entry;
+  append(dir, f, key, entry);
+  return true;
+}
+
+void OutputManifest::record(const std::string &dir,
+                            const std::string &key,
+                            const std::string &output,
+                            const std::string &srcFile,
+                            uint64_t settings,
+                            uint64_t srcHash) {
+  if (key.find_first_of("\t\n") != std::string::npos || output.find_first_of("\t\n") != std::string::npos) {
+    return; // cannot be stored in the manifest, always rebuilt
+  }
+  Entry entry{output, 0, 0, srcHash, settings};
+  if (!sourceStamp(srcFile, entry.size, entry.mtime)) {
+    return;
+  }
+  if (entry.hash == 0) {
+    entry.hash = hashFile(srcFile);
+  }
+
+  Folder &f = folder(dir);
+  std::lock_guard<std::mutex> lock(f.mtx);
+  if (!f.loaded) {
+    load(dir, f);
+  }
+  f.entries[key] = entry;
+  append(dir, f, key, entry);
+}
+
+// Size and modification time of a file the outputs depend on, so editing it in place invalidates them
+static std::string fileStamp(const std::string &path) {
+  if (path.empty()) {
+    return "-";
+  }
+  uintmax_t size;
+  int64_t mtime;
+  if (!sourceStamp(path, size, mtime)) {
+    return "-";
+  }
+  return std::to_string(size) + " " + std::to_string(mtime);
+}
+
+uint64_t hashBytes(const char *data, size_t size) { return OIIO::farmhash::Fingerprint64(data, size); }
+
+uint64_t hashFile(const std::string &path) {
+  MappedFile file;
+  if (!file.open(path)) {
+    return 0;
+  }
+  return hashBytes(file.data(), file.size());
+}
+
+uint64_t settingsFingerprint(const Settings &settings, const std::string &lutPreset) {
+  std::ostringstream text;
+  text << VERSION_MAJOR << "." << VERSION_MINOR << "\n";
+  text << settings.rangeMode << " " << settings.fileFormat << " " << settings.defFormat << " " << settings.bitDepth
+       << " " << settings.defBDepth << "\n";
+  text << settings.rawRot << " " << settings.rawSpace << " " << settings.dDemosaic << " " << settings.denoise_mode
+       << "\n";
+  const Settings::rawparms &raw = settings.rawParms;
+  text << raw.use_camera_wb << " " << raw.use_camera_matrix << " " << raw.use_auto_wb << " " << raw.highlight << " "
+       << raw.aber[0] << " " << raw.aber[1] << " " << raw.half_size << " " << raw.denoise_thr << " "
+       << raw.fbdd_noiserd << "\n";
+  text << settings.lutMode << " " << settings.ocioConfigPath << " " << fileStamp(settings.ocioConfigPath) << "\n";
+  // The file's preset and the default one, whose table the processor applies
+  for (const std::string &name : {lutPreset, settings.dLutPreset}) {
+    auto preset = settings.lut_Preset.find(name);
+    std::string presetFile = preset != settings.lut_Preset.end() ? preset->second : "";
+    text << name << " " << presetFile << " " << (presetFile.empty() ? "-" : fileStamp(lutPath(presetFile))) << "\n";
+  }
+  text << settings.sharp_mode << " " << settings.sharp_kernel << " " << settings.sharp_width << " "
+       << settings.sharp_contrast << " " << settings.sharp_tresh << "\n";
+  std::string bytes = text.str();
+  return hashBytes(bytes.data(), bytes.size());
+}
@@ -0,0 +1,135 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "unrawer/mapped_file.hpp"
+#include "unrawer/log.hpp"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string &path) {
+  close();
+
+  HANDLE file = CreateFileA(path.c_str(),
+                            GENERIC_READ,
+                            FILE_SHARE_READ,
+                            nullptr,
+                            OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    LOG(debug) << "MappedFile: cannot open " << path << ", error " << GetLastError() << std::endl;
+    return false;
+  }
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+
+  HANDLE map = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file); // the mapping object keeps the file open
+  if (map == nullptr) {
+    LOG(debug) << "MappedFile: cannot map " << path << ", error " << GetLastError() << std::endl;
+    return false;
+  }
+
+  void *view = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+  if (view == nullptr) {
+    LOG(debug) << "MappedFile: cannot map view of " << path << ", error " << GetLastError() << std::endl;
+    CloseHandle(map);
+    return false;
+  }
+
+  // Equivalent of MADV_WILLNEED, available since Windows 8
+  WIN32_MEMORY_RANGE_ENTRY range{view, static_cast<SIZE_T>(fileSize.QuadPart)};
+  PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+
+  mapping = map;
+  ptr = static_cast<const char *>(view);
+  len = static_cast<size_t>(fileSize.QuadPart);
+  return true;
+}
+
+void MappedFile::close() {
+  if (ptr) {
+    UnmapViewOfFile(ptr);
+    CloseHandle(static_cast<HANDLE>(mapping));
+    mapping = nullptr;
+    ptr = nullptr;
+    len = 0;
+  }
+}
+
+#else
+
+bool MappedFile::open(const std::string &path) {
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG(debug) << "MappedFile: cannot open " << path << std::endl;
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    ::close(fd);
+    return false;
+  }
+
+  size_t fileSize = static_cast<size_t>(st.st_size);
+  void *view = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd); // the mapping keeps its own reference to the file
+  if (view == MAP_FAILED) {
+    LOG(debug) << "MappedFile: cannot map " << path << std::endl;
+    return false;
+  }
+
+  // LibRaw walks the file front to back: aggressive read-ahead, start it now
+  madvise(view, fileSize, MADV_SEQUENTIAL);
+  madvise(view, fileSize, MADV_WILLNEED);
+
+  ptr = static_cast<const char *>(view);
+  len = fileSize;
+  return true;
+}
+
+void MappedFile::close() {
+  if (ptr) {
+    munmap(const_cast<char *>(ptr), len);
+    ptr = nullptr;
+    len = 0;
+  }
+}
+
+#endif
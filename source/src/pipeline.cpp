@@ -0,0 +1,305 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+
+#include "unrawer/log.hpp"
+#include "unrawer/pipeline.hpp"
+#include "unrawer/processors.hpp"
+
+// Indexed by Stage
+static const StageNode graph[kStageCount] = {
+    {Stage::Sorter, Sorter, edge(Stage::Reader), false},
+    {Stage::Reader, LReader, edge(Stage::Unpacker), false},
+    {Stage::Unpacker, LUnpacker, edge(Stage::Demosaic) | edge(Stage::RawDump), true}, // raw data is dumped as is
+    {Stage::Demosaic, Demosaic, edge(Stage::Dcraw) | edge(Stage::Writer), true},      // no demosaic writes with dcraw
+    {Stage::Dcraw, Dcraw, edge(Stage::Processor), true},
+    {Stage::Processor, Processor, edge(Stage::Writer), true},
+    {Stage::Writer, Writer, 0, true},
+    {Stage::RawDump, RawDump, 0, true},
+};
+
+// Bytes per raw pixel a file holds while a stage runs: unpacked bayer data (2), dcraw image (8), the 16-bit mem image
+// (6), the two float ping-pong buffers of LUT and unsharp (2 x 12) and the writer's converted copy (6). LibRaw keeps
+// its buffers until the writer is done with the file. The raw dump only needs the unpacked data, its write buffer is
+// per thread.
+static const size_t stageBytesPerPixel[kStageCount] = {0, 0, 2, 10, 16, 40, 28, 2};
+
+// Bytes a file still needs from `stage` on: the largest footprint of the stages ahead of it.
+// Before LibRaw has opened the file the pixel count is unknown and the file size stands in for it. Compressed raws
+// hold several pixels per byte, the reservation is corrected once the header is parsed and the file waits for
+// memory there if the real size does not fit.
+static size_t footprint(const ProcessingParams &processing, Stage stage) {
+  size_t pixels = processing.srcSize;
+  if (processing.raw_data) {
+    pixels = static_cast<size_t>(processing.raw_data->imgdata.sizes.raw_width) *
+             processing.raw_data->imgdata.sizes.raw_height;
+  }
+  size_t bpp = 0;
+  for (size_t s = static_cast<size_t>(stage); s < kStageCount; ++s) {
+    bpp = std::max(bpp, stageBytesPerPixel[s]);
+  }
+  size_t bytes = pixels * bpp;
+  if (stage <= Stage::Unpacker || processing.raw_buffer) {
+    bytes += processing.srcSize; // file buffer of the buffered and async readers, kept as long as LibRaw
+  }
+  return bytes;
+}
+
+Pipeline::Pipeline(Scheduler *scheduler, PipelineMode mode, MemoryBudget *budget)
+    : scheduler(scheduler), mode(mode), budget(budget) {
+  for (size_t s = 0; s < kStageCount; ++s) {
+    stage_files[s] = 0;
+    stage_failed[s] = 0;
+    stage_ns[s] = 0;
+  }
+}
+
+void Pipeline::submit(const std::string &fileName) {
+  auto processing = std::make_shared<ProcessingParams>();
+  processing->srcFile = fileName;
+  if (budget) {
+    std::error_code ec;
+    auto size = std::filesystem::file_size(fileName, ec);
+    processing->srcSize = ec ? 0 : static_cast<size_t>(size);
+    processing->reserved = footprint(*processing, Stage::Sorter);
+    budget->acquire(processing->reserved);
+  }
+  ++files_total;
+  schedule(Stage::Sorter, std::move(processing));
+}
+
+void Pipeline::close() {
+  {
+    std::lock_guard<std::mutex> lock(done_mutex);
+    closed = true;
+  }
+  done_cv.notify_all();
+}
+
+bool Pipeline::finished() const { return closed && files_done + files_failed + files_skipped == files_total; }
+
+void Pipeline::wait() {
+  std::unique_lock<std::mutex> lock(done_mutex);
+  done_cv.wait(lock, [this] { return finished(); });
+}
+
+float Pipeline::progress() const {
+  size_t total = files_total;
+  if (total == 0) {
+    return 0.0f;
+  }
+  return static_cast<float>(steps_done) / static_cast<float>(total * kStageCount);
+}
+
+void Pipeline::schedule(Stage stage, std::shared_ptr<ProcessingParams> processing) {
+  scheduler->post(
+      stage, [this, stage](std::shared_ptr<ProcessingParams> &entry) { run(stage, entry); }, std::move(processing));
+}
+
+void Pipeline::resume(Stage from, std::shared_ptr<ProcessingParams> processing, Step step) {
+  Stage next = advance(from, processing, step);
+  if (next != Stage::Count) {
+    schedule(next, std::move(processing));
+  }
+}
+
+void Pipeline::run(Stage stage, std::shared_ptr<ProcessingParams> &processing) {
+  while (stage != Stage::Count) {
+    size_t s = static_cast<size_t>(stage);
+    const StageNode &node = graph[s];
+    if (!reserve(processing, stage)) {
+      return; // set aside until memory is released, unpark() schedules it again
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    Step step = Step::failed();
+    try {
+      step = node.fn(processing);
+    } catch (const std::exception &e) {
+      LOG(error) << "Pipeline: " << stageName(stage) << " failed on " << processing->srcFile << ": " << e.what()
+                 << std::endl;
+    } catch (...) {
+      // LibRaw and codec plugins may throw types of their own, the file still has to reach a terminal state
+      LOG(error) << "Pipeline: " << stageName(stage) << " failed on " << processing->srcFile
+                 << ": unknown exception" << std::endl;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    stage_ns[s] += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    ++stage_files[s];
+    ++processing->steps;
+    ++steps_done;
+
+    stage = advance(stage, processing, step);
+  }
+}
+
+// Applies the outcome of `from`: returns the stage to run inline on this thread, or Stage::Count when the file was
+// scheduled, suspended or finished
+Stage Pipeline::advance(Stage from, std::shared_ptr<ProcessingParams> &processing, Step step) {
+  const StageNode &node = graph[static_cast<size_t>(from)];
+
+  if (step.state == FileState::Running) {
+    if (node.edges & edge(step.next)) {
+      if (mode == PipelineMode::Fused && graph[static_cast<size_t>(step.next)].fusable) {
+        return step.next; // keep the file on this worker
+      }
+      schedule(step.next, processing);
+      return Stage::Count;
+    }
+    LOG(error) << "Pipeline: invalid transition " << stageName(from) << " -> " << stageName(step.next) << " for "
+               << processing->srcFile << std::endl;
+    step = Step::failed();
+  } else if (step.state == FileState::Suspended) {
+    return Stage::Count; // whoever took the file over calls resume()
+  } else if (step.state == FileState::Done && node.edges != 0) {
+    LOG(error) << "Pipeline: " << stageName(from) << " is not a terminal stage" << std::endl;
+    step = Step::failed();
+  }
+
+  if (step.state == FileState::Failed) {
+    ++stage_failed[static_cast<size_t>(from)];
+  }
+  finish(processing, step.state);
+  return Stage::Count;
+}
+
+void Pipeline::finish(std::shared_ptr<ProcessingParams> &processing, FileState state) {
+  if (state == FileState::Failed) {
+    processing->setStatus(ProcessingStatus::Failed);
+    LOG(error) << "Pipeline: failed " << processing->srcFile << std::endl;
+  }
+
+  // Release whatever the file still holds, failed files may stop anywhere in the graph
+  processing->image.reset();
+  processing->buffers.clear(); // only after the image, it may wrap them
+  processing->clearRawImage();
+  processing->raw_data.reset();
+  processing->raw_map.reset(); // only after LibRaw, it may still point into the mapping or the buffer
+  processing->raw_buffer.reset();
+  if (processing->bytesCopied > 0) {
+    LOG(debug) << "Pipeline: " << (processing->bytesCopied >> 20) << " MB of pixels copied for " << processing->srcFile
+               << std::endl;
+    bytes_copied += processing->bytesCopied;
+  }
+  if (budget) {
+    budget->release(processing->reserved);
+    processing->reserved = 0;
+    unpark();
+  }
+
+  // Before the counters, wait() must not return while a callback is still running
+  if (file_done) {
+    file_done(*processing, state != FileState::Failed);
+  }
+
+  // Stages a file skipped still count, so progress ends at exactly 1.0
+  steps_done += kStageCount - std::min<size_t>(processing->steps, kStageCount);
+
+  // Counted and notified under the lock: wait() cannot see the batch finished before the last file's notify, and
+  // nothing touches the pipeline after it, the caller may destroy it as soon as wait() returns
+  std::lock_guard<std::mutex> lock(done_mutex);
+  if (state == FileState::Done) {
+    ++files_done;
+  } else if (state == FileState::Skipped) {
+    ++files_skipped;
+  } else {
+    ++files_failed;
+  }
+  if (finished()) {
+    done_cv.notify_all();
+  }
+}
+
+// Moves the file's reservation to what is left ahead of `stage`, refined once LibRaw knows the real image size.
+// Growth that does not fit parks the file instead of blocking the worker: the files holding the memory may be
+// queued behind it and need a worker to finish.
+bool Pipeline::reserve(std::shared_ptr<ProcessingParams> &processing, Stage stage) {
+  if (!budget) {
+    return true;
+  }
+  size_t bytes = footprint(*processing, stage);
+  if (bytes == processing->reserved) {
+    return true;
+  }
+  LOG(trace) << "Pipeline: " << stageName(stage) << " memory for " << processing->srcFile << ": "
+             << (processing->reserved >> 20) << " -> " << (bytes >> 20) << " MB" << std::endl;
+  if (bytes < processing->reserved) {
+    budget->resize(processing->reserved, bytes);
+    processing->reserved = bytes;
+    unpark();
+    return true;
+  }
+  std::lock_guard<std::mutex> lock(park_mutex);
+  if (budget->tryGrow(processing->reserved, bytes, parked_bytes)) {
+    processing->reserved = bytes;
+    return true;
+  }
+  LOG(debug) << "Pipeline: " << processing->srcFile << " waits for " << (bytes >> 20) << " MB" << std::endl;
+  parked_bytes += processing->reserved;
+  parked.push_back({stage, processing});
+  return false;
+}
+
+// Reschedules parked files in arrival order for as long as they fit
+void Pipeline::unpark() {
+  std::lock_guard<std::mutex> lock(park_mutex);
+  while (!parked.empty()) {
+    Parked &front = parked.front();
+    size_t bytes = footprint(*front.processing, front.stage);
+    size_t held = front.processing->reserved;
+    if (!budget->tryGrow(held, std::max(bytes, held), parked_bytes - held)) {
+      break;
+    }
+    front.processing->reserved = std::max(bytes, held);
+    parked_bytes -= held;
+    schedule(front.stage, std::move(front.processing));
+    parked.pop_front();
+  }
+}
+
+PipelineStageTotals Pipeline::stageTotals(Stage stage) const {
+  size_t s = static_cast<size_t>(stage);
+  return {stage_files[s], stage_failed[s], static_cast<double>(stage_ns[s]) * 1e-9};
+}
+
+void Pipeline::report(double wallSec) const {
+  LOG(info) << "Pipeline: " << (mode == PipelineMode::Fused ? "fused" : "staged") << " mode, " << files_done
+            << " written, " << files_skipped << " up to date, " << files_failed << " failed of " << files_total
+            << " files" << std::endl;
+  LOG(info) << "Pipeline: " << (bytes_copied >> 20) << " MB of pixels copied between stages and for the writer"
+            << std::endl;
+  if (budget) {
+    LOG(info) << "Pipeline: memory high water " << (budget->highWater() >> 20) << " MB of "
+              << (budget->capacity() ? std::to_string(budget->capacity() >> 20) + " MB" : std::string("unlimited"))
+              << std::endl;
+  }
+  for (size_t s = 0; s < kStageCount; ++s) {
+    size_t files = stage_files[s];
+    if (files == 0) {
+      continue;
+    }
+    double busy = static_cast<double>(stage_ns[s]) * 1e-9;
+    LOG(info) << "Pipeline: " << stageName(static_cast<Stage>(s)) << ": " << files << " files, " << stage_failed[s]
+              << " failed, " << busy * 1000.0 / files << " ms/file, "
+              << (wallSec > 0.0 ? files / wallSec : 0.0) << " files/s" << std::endl;
+  }
+}
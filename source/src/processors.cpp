@@ -16,36 +16,30 @@
  */
 
 #include "unrawer/processors.hpp"
+#include "unrawer/raw_dump.hpp"
 #include "unrawer/unrawer.hpp"
 
 OutPaths outpaths;
 
-bool isRaw(QString file, const std::unordered_set<std::string> &raw_ext_set) {
-  QFileInfo fileInfo(file);
-  QString ext = fileInfo.suffix().toLower();
+bool isRaw(const std::string &file, const std::unordered_set<std::string> &raw_ext_set) {
+  std::string name = std::filesystem::path(file).filename().string();
+  size_t dot = name.rfind('.');
+  std::string ext = dot == std::string::npos ? "" : toLower(name.substr(dot + 1));
 
-  if (raw_ext_set.find(ext.toStdString()) != raw_ext_set.end()) {
+  if (raw_ext_set.find(ext) != raw_ext_set.end()) {
     return true;
   }
   return false;
 }
 
-void Sorter(int index,
-            QString fileName,
-            std::shared_ptr<ProcessingParams> &processing_entry,
-            std::atomic_size_t *fileCntr,
-            std::map<std::string, std::unique_ptr<ThreadPool>> *myPools) {
-
-  auto processing = std::make_shared<ProcessingParams>();
-  processing->srcFile = fileName.toStdString();
-
-  QString prest_sfx = "";
-  auto [path, parentFolderName, baseName, extension] = splitPath(fileName);
+Step Sorter(std::shared_ptr<ProcessingParams> &processing) {
+  std::string prest_sfx = "";
+  auto [path, parentFolderName, baseName, extension] = splitPath(processing->srcFile);
 
   std::optional<std::string> lut_preset =
       getPresetfromName(parentFolderName + "/" + baseName, &settings); // std::string or std::nullopt
   if (lut_preset.has_value()) {
-    prest_sfx = lut_preset.value().c_str();
+    prest_sfx = lut_preset.value();
   } else {
     LOG(debug) << "PRE: No suitable LUT preset was found from file name" << std::endl;
   }
@@ -55,32 +49,37 @@ void Sorter(int index,
     auto lut_preset_it = settings.lut_Preset.find(settings.dLutPreset);
     if (lut_preset_it != settings.lut_Preset.end()) { // if the preset was found in the map
       lut_preset = lut_preset_it->first;
-      prest_sfx = lut_preset.value().c_str();
+      prest_sfx = lut_preset.value();
     } else {
       // lut_preset remains empty or has the value from file name
       LOG(error) << "PRE: LUT preset " << settings.dLutPreset << " not found" << std::endl;
     }
   } else if (settings.lutMode == 0 && lut_preset.has_value()) {
     // LUT mode set to auto and file or path contains LUT preset name
-    prest_sfx = lut_preset.value().c_str();
+    prest_sfx = lut_preset.value();
   }
   auto [outPath, outName, outExt] = getOutName(path, baseName, extension, prest_sfx, &settings);
 
-  auto [exist, path_idx] = outpaths.try_add(outPath.toStdString());
+  auto [exist, path_idx] = outpaths.try_add(outPath);
   if (!exist) {
-    LOG(debug) << "PRE: New output path added: " << outPath.toStdString() << std::endl;
+    LOG(debug) << "PRE: New output path added: " << outPath << std::endl;
   }
   processing->outPathIdx = path_idx;
-  processing->outFile = outName.toStdString();
-  processing->outExt = outExt.toStdString();
+  processing->outFile = outName;
+  processing->outExt = outExt;
   processing->lut_preset = lut_preset.value_or("");
+  processing->fingerprint = settingsFingerprint(settings, processing->lut_preset);
+  if (settings.skipUpToDate &&
+      procGlobals.manifest.upToDate(outPath, processing->outFile, processing->srcFile, processing->fingerprint)) {
+    LOG(info) << "PRE: Up to date, skipped: " << processing->srcFile << std::endl;
+    processing->setStatus(ProcessingStatus::Skipped);
+    return Step::skipped();
+  }
   LOG(debug) << "PRE: Preprocessing file " << processing->srcFile << " > "
              << outpaths.get_path(path_idx) + "/" + processing->outFile + processing->outExt << std::endl;
 
-  processing_entry = processing;
   processing->setStatus(ProcessingStatus::Prepared);
-  //
-  (*myPools)["LReader"]->enqueue(LReader, index, processing_entry, fileCntr, myPools);
+  return Step::to(Stage::Reader);
 }
 
 bool read_chunk(std::ifstream *file, std::vector<char> &raw_buffer, std::streamoff start, std::streamoff end) {
@@ -95,20 +94,15 @@ bool read_chunk(std::ifstream *file, std::vector<char> &raw_buffer, std::streamo
 }
 
 // oiio file reader
-void oReader(int index,
-             std::shared_ptr<ProcessingParams> &processing_entry,
-             std::atomic_size_t *fileCntr,
-             std::map<std::string, std::unique_ptr<ThreadPool>> *myPools) {
+Step oReader(std::shared_ptr<ProcessingParams> &processing) {
 
   TypeDesc out_format;
 
-  auto processing = processing_entry;
 
   LOG(info) << "Reader: file " << processing->srcFile << std::endl;
 
-  QFileInfo fileInfo(processing->srcFile.c_str());
-  if (fileInfo.isSymLink()) {
-    std::string symLinkTarget = fileInfo.symLinkTarget().toStdString();
+  std::string symLinkTarget = resolveSymlink(processing->srcFile);
+  if (symLinkTarget != processing->srcFile) {
     LOG(debug) << "Reader: File is a symlink to: " << symLinkTarget << std::endl;
     processing->srcFile = symLinkTarget;
   }
@@ -191,8 +185,6 @@ void oReader(int index,
     break;
   }
 
-  (*fileCntr)--;
-
   bool read_ok = inBuf.read(0, 0, 0, last_channel, true, o_format, nullptr, nullptr);
   if (!read_ok) {
     LOG(error) << "READ: Error! Could not read input image\n";
@@ -218,39 +210,70 @@ void oReader(int index,
             << std::endl;
 
   // return { true, {std::make_shared<OIIO::ImageBuf>(outBuf), orig_format} };
-  processing->image = std::make_shared<OIIO::ImageBuf>(inBuf);
-  (*fileCntr)--;
-  (*myPools)["OProcessor"]->enqueue(OProcessor, index, processing_entry, fileCntr, myPools);
+  processing->image = std::make_shared<OIIO::ImageBuf>(std::move(inBuf));
+  return Step::to(Stage::Processor);
+}
+
+// LibRaw processor for the file, recycled from the pool when there is one, set up from the settings.
+// Parameters are set on every file, recycle() keeps whatever the previous file used.
+static LibRaw *attachLibRaw(std::shared_ptr<ProcessingParams> &processing) {
+  processing->raw_data =
+      procGlobals.libraw_pool ? procGlobals.libraw_pool->acquire() : std::make_shared<LibRaw>();
+  LibRaw *raw = processing->raw_data.get();
+
+  raw->imgdata.params.use_camera_wb = settings.rawParms.use_camera_wb;
+  raw->imgdata.params.use_camera_matrix = settings.rawParms.use_camera_matrix;
+  raw->imgdata.params.highlight = settings.rawParms.highlight;
+  raw->imgdata.params.aber[0] = settings.rawParms.aber[0];
+  raw->imgdata.params.aber[1] = settings.rawParms.aber[1];
+  // raw->imgdata.params.exp_correc = settings.rawParms.exp_correc;
+  raw->imgdata.params.half_size = settings.rawParms.half_size;
+
+  raw->imgdata.params.output_color = settings.rawSpace;
+
+  raw->imgdata.params.user_flip = settings.rawRot;
+
+  if (settings.denoise_mode == 1 || settings.denoise_mode == 3) {
+    raw->imgdata.params.threshold = settings.rawParms.denoise_thr;
+  } else {
+    raw->imgdata.params.threshold = 0.0f;
+  }
+
+  if (settings.denoise_mode == 2 || settings.denoise_mode == 3) {
+    raw->imgdata.params.fbdd_noiserd = settings.rawParms.fbdd_noiserd;
+  } else {
+    raw->imgdata.params.fbdd_noiserd = 0;
+  }
+  return raw;
 }
 
 // LibRaw buffer reader
-void Reader(int index,
-            std::shared_ptr<ProcessingParams> &processing_entry,
-            std::atomic_size_t *fileCntr,
-            std::map<std::string, std::unique_ptr<ThreadPool>> *myPools) {
-  auto processing = processing_entry;
+Step Reader(std::shared_ptr<ProcessingParams> &processing) {
 
   LOG(info) << "Reader: file " << processing->srcFile << std::endl;
 
-  QFileInfo fileInfo(processing->srcFile.c_str());
-  if (fileInfo.isSymLink()) {
-    std::string symLinkTarget = fileInfo.symLinkTarget().toStdString();
+  std::string symLinkTarget = resolveSymlink(processing->srcFile);
+  if (symLinkTarget != processing->srcFile) {
     LOG(debug) << "Reader: File is a symlink to: " << symLinkTarget << std::endl;
     processing->srcFile = symLinkTarget;
   }
 
   std::ifstream file(processing->srcFile, std::ios::binary | std::ios::ate);
-  if (!file)
+  if (!file) {
     LOG(error) << "Reader: Could not open file: " << processing->srcFile << std::endl;
+    return Step::failed();
+  }
 
   const auto fileSize = file.tellg();
-  if (fileSize < 0)
+  if (fileSize < 0) {
     LOG(error) << "Reader: Could not determine size of file: " << processing->srcFile << std::endl;
+    return Step::failed();
+  }
   file.seekg(0);
 
   LOG(debug) << "Reader: File size: " << fileSize << std::endl;
 
-  std::vector<char> raw_buffer(fileSize);
+  auto raw_buffer = std::make_shared<std::vector<char>>(fileSize);
 
 #if 0
     const int numThreads = 3;
@@ -263,111 +286,70 @@ void Reader(int index,
         if (i == numThreads - 1) {
             end = fileSize;
         }
-        poolChRead.enqueue(read_chunk, std::ref(file), std::ref(raw_buffer), start, end);
+        poolChRead.enqueue(read_chunk, std::ref(file), std::ref(*raw_buffer), start, end);
     }
     poolChRead.waitForAllTasks();
 #endif
 
 #if 1
-  if (!file.read(raw_buffer.data(), fileSize)) {
+  if (!file.read(raw_buffer->data(), fileSize)) {
     throw std::runtime_error("Reader: Could not read file: " + processing->srcFile);
   }
 #endif
-  std::shared_ptr<std::vector<char>> raw_buffer_ptr = std::make_shared<std::vector<char>>(raw_buffer);
+  processing->raw_buffer = std::move(raw_buffer);
 
   processing->setStatus(ProcessingStatus::Loaded);
   file.close();
 
-  (*fileCntr)--;
-
-  (*myPools)["unpacker"]->enqueue(Unpacker, index, processing_entry, raw_buffer_ptr, fileCntr, myPools);
+  return Step::to(Stage::Unpacker);
 }
 
 // Libraw disk reader
-void LReader(int index,
-             std::shared_ptr<ProcessingParams> &processing_entry,
-             std::atomic_size_t *fileCntr,
-             std::map<std::string, std::unique_ptr<ThreadPool>> *myPools) {
-  auto processing = processing_entry;
-
-  QFileInfo fileInfo(processing->srcFile.c_str());
-  if (fileInfo.isSymLink()) {
-    std::string symLinkTarget = fileInfo.symLinkTarget().toStdString();
+Step LReader(std::shared_ptr<ProcessingParams> &processing) {
+
+  std::string symLinkTarget = resolveSymlink(processing->srcFile);
+  if (symLinkTarget != processing->srcFile) {
     LOG(debug) << "Reader: File is a symlink to: " << symLinkTarget << std::endl;
     processing->srcFile = symLinkTarget;
   }
 
-  // LibRaw& raw = processing->raw_data;
-  std::shared_ptr<LibRaw> raw_ptr = std::make_shared<LibRaw>();
-  processing->raw_data = raw_ptr;
-  LibRaw *raw = raw_ptr.get();
-
-  raw->imgdata.params.use_camera_wb = settings.rawParms.use_camera_wb;
-  raw->imgdata.params.use_camera_matrix = settings.rawParms.use_camera_matrix;
-  raw->imgdata.params.highlight = settings.rawParms.highlight;
-  raw->imgdata.params.aber[0] = settings.rawParms.aber[0];
-  raw->imgdata.params.aber[1] = settings.rawParms.aber[1];
-  // raw->imgdata.params.exp_correc = settings.rawParms.exp_correc;
-  raw->imgdata.params.half_size = settings.rawParms.half_size;
-
-  raw->imgdata.params.output_color = settings.rawSpace;
-
-  raw->imgdata.params.user_flip = settings.rawRot;
-
-  if (settings.denoise_mode == 1 || settings.denoise_mode == 3) {
-    raw->imgdata.params.threshold = settings.rawParms.denoise_thr;
-  } else {
-    raw->imgdata.params.threshold = 0.0f;
+  // io_uring reads the file without holding this worker, the reader resumes the file at the unpacker
+  if (settings.readMode == 2 && procGlobals.async_reader && procGlobals.async_reader->read(processing)) {
+    LOG(info) << "Async Reader: file " << processing->srcFile << std::endl;
+    return Step::suspend();
   }
 
-  if (settings.denoise_mode == 2 || settings.denoise_mode == 3) {
-    raw->imgdata.params.fbdd_noiserd = settings.rawParms.fbdd_noiserd;
-  } else {
-    raw->imgdata.params.fbdd_noiserd = 0;
-  }
+  LibRaw *raw = attachLibRaw(processing);
 
   LOG(info) << "Libraw Reader: file " << processing->srcFile << std::endl;
 
-  // int ret = raw->open_buffer(raw_buffer->data(), raw_buffer->size());
-  int ret = raw->open_file(processing->srcFile.c_str());
+  int ret;
+  auto raw_map = std::make_shared<MappedFile>();
+  if (settings.readMode >= 1 && raw_map->open(processing->srcFile)) {
+    // LibRaw parses straight out of the page cache, the mapping lives as long as the file is processed
+    processing->raw_map = raw_map;
+    ret = raw->open_buffer(const_cast<char *>(raw_map->data()), raw_map->size());
+  } else {
+    if (settings.readMode >= 1) {
+      LOG(debug) << "Reader: Cannot map file, reading it through LibRaw: " << processing->srcFile << std::endl;
+    }
+    ret = raw->open_file(processing->srcFile.c_str());
+  }
   if (ret != LIBRAW_SUCCESS) {
     LOG(error) << "Reader: Cannot read file: " << processing->srcFile << std::endl;
-    return;
+    return Step::failed();
   }
 
-  (*fileCntr)--;
-
-  (*myPools)["LUnpacker"]->enqueue(LUnpacker, index, processing_entry, fileCntr, myPools);
-  /*
-      LOG(info) << "Unpack: file " << processing->srcFile << std::endl;
-
-      ret = raw->unpack();
-      if (ret != LIBRAW_SUCCESS) {
-          LOG(error) << "Unpack: Cannot unpack data from file: " << processing->srcFile << std::endl;
-          return;
-      }
-
-      processing->setStatus(ProcessingStatus::Unpacked);
-
-      (*fileCntr)--;
-
-      if (settings.dDemosaic > -2) {
-          (*myPools)["demosaic"]->enqueue(Demosaic, index, processing_entry, fileCntr, myPools);
-      }
-      else {
-          (*fileCntr)--; // no demosaic, so we can skip the processor
-          (*fileCntr)--; // no demosaic, so we can skip the writer
-          (*myPools)["writer"]->enqueue(Writer, index, processing_entry, fileCntr, myPools);
-      }
-  */
+  processing->setStatus(ProcessingStatus::Loaded);
+  return Step::to(Stage::Unpacker);
 }
 
 // Libraw disk unpacker
-void LUnpacker(int index,
-               std::shared_ptr<ProcessingParams> &processing_entry,
-               std::atomic_size_t *fileCntr,
-               std::map<std::string, std::unique_ptr<ThreadPool>> *myPools) {
-  auto processing = processing_entry;
+Step LUnpacker(std::shared_ptr<ProcessingParams> &processing) {
+  if (!processing->raw_data) {
+    return Unpacker(processing); // read asynchronously, LibRaw opens it from the buffer
+  }
+
   LOG(info) << "Unpack: file " << processing->srcFile << std::endl;
 
   // LibRaw& raw = processing->raw_data;
@@ -380,88 +362,45 @@ void LUnpacker(int index,
   int ret = raw->unpack();
   if (ret != LIBRAW_SUCCESS) {
     LOG(error) << "Unpack: Cannot unpack data from file: " << processing->srcFile << std::endl;
-    return;
+    return Step::failed();
   }
 
   processing->setStatus(ProcessingStatus::Unpacked);
 
   if (settings.dDemosaic > -2) {
-    (*fileCntr)--;
-    (*myPools)["demosaic"]->enqueue(Demosaic, index, processing_entry, fileCntr, myPools);
-  } else {
-    (*fileCntr) -= 4; // can skip the writer
-    (*myPools)["writer"]->enqueue(Writer, index, processing_entry, fileCntr, myPools);
+    return Step::to(Stage::Demosaic);
   }
+  return Step::to(Stage::RawDump); // raw data, no demosaic and processing
 }
 
 // Libraw buffer unpacker
-void Unpacker(int index,
-              std::shared_ptr<ProcessingParams> &processing_entry,
-              std::shared_ptr<std::vector<char>> raw_buffer,
-              std::atomic_size_t *fileCntr,
-              std::map<std::string, std::unique_ptr<ThreadPool>> *myPools) {
-  auto processing = processing_entry;
+Step Unpacker(std::shared_ptr<ProcessingParams> &processing) {
   LOG(info) << "Unpack: file " << processing->srcFile << std::endl;
 
-  // LibRaw& raw = processing->raw_data;
-  std::shared_ptr<LibRaw> raw_ptr = std::make_shared<LibRaw>();
-  processing->raw_data = raw_ptr;
-  LibRaw *raw = raw_ptr.get();
-
-  raw->imgdata.params.use_camera_wb = settings.rawParms.use_camera_wb;
-  raw->imgdata.params.use_camera_matrix = settings.rawParms.use_camera_matrix;
-  raw->imgdata.params.highlight = settings.rawParms.highlight;
-  raw->imgdata.params.aber[0] = settings.rawParms.aber[0];
-  raw->imgdata.params.aber[1] = settings.rawParms.aber[1];
-  // raw->imgdata.params.exp_correc = settings.rawParms.exp_correc;
-  raw->imgdata.params.half_size = settings.rawParms.half_size;
-
-  raw->imgdata.params.output_color = settings.rawSpace;
-
-  raw->imgdata.params.user_flip = settings.rawRot;
-
-  if (settings.denoise_mode == 1 || settings.denoise_mode == 3) {
-    raw->imgdata.params.threshold = settings.rawParms.denoise_thr;
-  } else {
-    raw->imgdata.params.threshold = 0.0f;
-  }
-
-  if (settings.denoise_mode == 2 || settings.denoise_mode == 3) {
-    raw->imgdata.params.fbdd_noiserd = settings.rawParms.fbdd_noiserd;
-  } else {
-    raw->imgdata.params.fbdd_noiserd = 0;
-  }
+  LibRaw *raw = attachLibRaw(processing);
 
+  auto raw_buffer = processing->raw_buffer;
   int ret = raw->open_buffer(raw_buffer->data(), raw_buffer->size());
   if (ret != LIBRAW_SUCCESS) {
     LOG(error) << "Unpack: Cannot read buffer: " << processing->srcFile << std::endl;
-    return;
+    return Step::failed();
   }
 
   ret = raw->unpack();
   if (ret != LIBRAW_SUCCESS) {
     LOG(error) << "Unpack: Cannot unpack data from file: " << processing->srcFile << std::endl;
-    return;
+    return Step::failed();
   }
 
   processing->setStatus(ProcessingStatus::Unpacked);
 
-  (*fileCntr)--;
-
   if (settings.dDemosaic > -2) {
-    (*myPools)["demosaic"]->enqueue(Demosaic, index, processing_entry, fileCntr, myPools);
-  } else {
-    (*fileCntr)--; // no demosaic, so we can skip the processor
-    (*fileCntr)--; // no demosaic, so we can skip the writer
-    (*myPools)["processor"]->enqueue(Writer, index, processing_entry, fileCntr, myPools);
+    return Step::to(Stage::Demosaic);
   }
+  return Step::to(Stage::RawDump); // raw data, no demosaic and processing
 }
 
-void Demosaic(int index,
-              std::shared_ptr<ProcessingParams> &processing_entry,
-              std::atomic_size_t *fileCntr,
-              std::map<std::string, std::unique_ptr<ThreadPool>> *myPools) {
-  auto processing = processing_entry;
+Step Demosaic(std::shared_ptr<ProcessingParams> &processing) {
   std::shared_ptr<LibRaw> raw = processing->raw_data;
   LOG(info) << "Demosaic: file " << processing->srcFile << std::endl;
 
@@ -475,12 +414,11 @@ void Demosaic(int index,
 
     if (raw->dcraw_process() != LIBRAW_SUCCESS) {
       LOG(error) << "Demosaic: Cannot process data from file" << processing->srcFile << std::endl;
-      return;
+      return Step::failed();
     }
     processing->setStatus(ProcessingStatus::Demosaiced);
 
-    (*fileCntr) -= 3;
-    (*myPools)["writer"]->enqueue(Writer, index, processing_entry, fileCntr, myPools);
+    return Step::to(Stage::Writer);
   } else if (settings.dDemosaic > -1) {
     raw_parms.output_bps = 16;
     raw_parms.user_qual = settings.dDemosaic;
@@ -488,24 +426,18 @@ void Demosaic(int index,
 
     if (raw->dcraw_process() != LIBRAW_SUCCESS) {
       LOG(error) << "Demosaic: Cannot process data from file" << processing->srcFile << std::endl;
-      return;
+      return Step::failed();
     }
     processing->setStatus(ProcessingStatus::Demosaiced);
 
-    (*fileCntr)--;
-    (*myPools)["dcraw"]->enqueue(Dcraw, index, processing_entry, fileCntr, myPools);
-  } else {
-    LOG(error) << "Demosaic: Unknown demosaic mode" << std::endl;
-    return;
+    return Step::to(Stage::Dcraw);
   }
+  LOG(error) << "Demosaic: Unknown demosaic mode" << std::endl;
+  return Step::failed();
 }
 
 // libraw dcraw dcraw_make_mem_image()
-void Dcraw(int index,
-           std::shared_ptr<ProcessingParams> &processing_entry,
-           std::atomic_size_t *fileCntr,
-           std::map<std::string, std::unique_ptr<ThreadPool>> *myPools) {
-  auto processing = processing_entry;
+Step Dcraw(std::shared_ptr<ProcessingParams> &processing) {
 
   std::shared_ptr<LibRaw> raw = processing->raw_data;
 
@@ -514,265 +446,132 @@ void Dcraw(int index,
   auto &raw_parms = raw->imgdata.params;
   raw_parms.output_bps = 16;
 
+  if (procGlobals.buffer_pool) {
+    // Same layout dcraw_make_mem_image() returns, in a recycled block instead of a fresh malloc
+    int width, height, colors, bps;
+    raw->get_mem_image_format(&width, &height, &colors, &bps);
+    int stride = width * colors * (bps / 8);
+    size_t data_size = static_cast<size_t>(height) * stride;
+    PooledBuffer mem = procGlobals.buffer_pool->acquire(sizeof(libraw_processed_image_t) + data_size);
+    if (!mem) {
+      LOG(error) << "Dcraw: Cannot allocate image for file: " << processing->srcFile << std::endl;
+      return Step::failed();
+    }
+    auto *image = static_cast<libraw_processed_image_t *>(mem.data());
+    image->type = LIBRAW_IMAGE_BITMAP;
+    image->height = static_cast<ushort>(height);
+    image->width = static_cast<ushort>(width);
+    image->colors = static_cast<ushort>(colors);
+    image->bits = static_cast<ushort>(bps);
+    image->data_size = static_cast<unsigned>(data_size);
+    if (raw->copy_mem_image(image->data, stride, 0) != LIBRAW_SUCCESS) {
+      LOG(error) << "Dcraw: Cannot process data from file: " << processing->srcFile << std::endl;
+      return Step::failed();
+    }
+    processing->raw_image_mem = std::move(mem);
+    processing->raw_image = image;
+    return Step::to(Stage::Processor);
+  }
+
   // libraw_processed_image_t* image = raw->dcraw_make_mem_image();
   processing->raw_image = raw->dcraw_make_mem_image();
 
   if (!processing->raw_image) {
     LOG(error) << "Dcraw: Cannot process data from file: " << processing->srcFile << std::endl;
-    return;
+    return Step::failed();
   }
 
-  (*fileCntr)--;
-  (*myPools)["processor"]->enqueue(Processor, index, processing_entry, fileCntr, myPools);
+  return Step::to(Stage::Processor);
 }
 
-void Processor(int index,
-               std::shared_ptr<ProcessingParams> &processing_entry,
-               std::atomic_size_t *fileCntr,
-               std::map<std::string, std::unique_ptr<ThreadPool>> *myPools) {
-
-  auto processing = processing_entry;
-  std::shared_ptr<LibRaw> raw = processing->raw_data;
+Step Processor(std::shared_ptr<ProcessingParams> &processing) {
 
   LOG(debug) << "Processor: Processing data from file: " << processing->srcFile << std::endl;
 
   libraw_processed_image_t *image = processing->raw_image;
 
+  // Wraps the LibRaw memory image, no copy
   OIIO::ImageSpec image_spec(image->width, image->height, image->colors, OIIO::TypeDesc::UINT16);
   OIIO::ImageBuf image_buf(image_spec, image->data);
 
-  // auto [process_ok, out_buf] = imgProcessor(std::ref<ImageBuf>(image_buf), procGlobals.ocio_conf_ptr.get(),
-  // &settings.dLutPreset, processing_entry, image, nullptr, nullptr); if (!process_ok) {
-  //     LOG(error) << "Error processing " << processing->srcFile << std::endl;
-  //     //mainWindow->emitUpdateTextSignal("Error! Check console for details");
-  //     return;
-  // }
-  ImageBuf out_buf; // result_buf, rgba_buf, original_alpha, bit_alpha_buf;
-  ImageBuf lut_buf;
-  ImageBuf uns_buf;
-  ImageBuf *out_buf_ptr = &out_buf;
-  ImageBuf *lut_buf_ptr = &lut_buf;
-  ImageBuf *uns_buf_ptr = &uns_buf;
-  // LUT Transform
-  bool lutValid = false;
-  // check if lut_preset is not nullptr set lutValid to true
-  if (settings.dLutPreset != "") {
-    lutValid = true;
-  }
-  // auto test = input_buf.spec();
-  // std::cout << test.width << " " << test.height << " " << test.nchannels << std::endl;
-  LOG(trace) << "Input image: " << image_buf.spec().width << "x" << image_buf.spec().height << "x"
-             << image_buf.spec().nchannels << std::endl;
-  LOG(trace) << "Input image: " << image_buf.spec().format << std::endl;
-
-  if (settings.lutMode >= 0 && lutValid) {
-    auto lutPreset = settings.lut_Preset[settings.dLutPreset];
-    if (ImageBufAlgo::ociofiletransform(
-            *lut_buf_ptr, image_buf, lutPreset, false, false, procGlobals.ocio_conf_ptr.get())) {
-      LOG(info) << "LUT preset " << settings.dLutPreset << " <" << lutPreset << "> "
-                << " applied" << std::endl;
-      processing_entry->setStatus(ProcessingStatus::Graded);
-      image_buf.clear();
-      if (!processing_entry->rawCleared) {
-        processing_entry->raw_data->dcraw_clear_mem(image);
-        processing_entry->rawCleared = true;
-      }
-    } else {
-      LOG(error) << "LUT not applied: " << lut_buf.geterror() << std::endl;
-      lut_buf_ptr = &image_buf;
-    }
-  } else {
-    LOG(debug) << "LUT transformation disabled" << std::endl;
-    lut_buf_ptr = &image_buf;
-  }
-
-  (*fileCntr)--;
-
-  // Apply unsharp mask
-
-  if (settings.sharp_mode != -1) {
-    string_view kernel = settings.sharp_kerns[settings.sharp_kernel];
-    float width = settings.sharp_width;
-    float contrast = settings.sharp_contrast;
-    float threshold = settings.sharp_tresh;
-    if (ImageBufAlgo::unsharp_mask(*uns_buf_ptr, *lut_buf_ptr, kernel, width, contrast, threshold)) {
-      LOG(debug) << "Unsharp mask applied: <" << kernel.c_str() << ">" << std::endl;
-      processing_entry->setStatus(ProcessingStatus::Unsharped);
-      lut_buf_ptr->clear();
-      if (!processing_entry->rawCleared) {
-        processing_entry->raw_data->dcraw_clear_mem(image);
-        processing_entry->rawCleared = true;
-      }
-    } else {
-      LOG(error) << "Unsharp mask not applied: " << uns_buf.geterror() << std::endl;
-      uns_buf_ptr = lut_buf_ptr;
-    }
-  } else {
-    LOG(debug) << "Unsharp mask disabled" << std::endl;
-    uns_buf_ptr = lut_buf_ptr;
+  auto [process_ok, out_buf] = imgProcessor(
+      image_buf, procGlobals.ocio_conf_ptr.get(), &settings.dLutPreset, processing, image);
+  if (!process_ok) {
+    LOG(error) << "Error processing " << processing->srcFile << std::endl;
+    return Step::failed();
   }
 
-  // temp copy for saving
-  out_buf_ptr = uns_buf_ptr;
-
-  ///    return { true, std::make_shared<ImageBuf>(*out_buf_ptr) };
-  ///
-  processing->image = std::make_shared<ImageBuf>(*out_buf_ptr);
+  processing->image = std::move(out_buf);
   processing->outSpec = std::make_shared<OIIO::ImageSpec>(image_spec);
 
   processing->setStatus(ProcessingStatus::Processed);
 
-  (*fileCntr)--;
-
-  (*myPools)["writer"]->enqueue(Writer, index, processing_entry, fileCntr, myPools);
+  return Step::to(Stage::Writer);
 }
 
-void OProcessor(int index,
-                std::shared_ptr<ProcessingParams> &processing_entry,
-                std::atomic_size_t *fileCntr,
-                std::map<std::string, std::unique_ptr<ThreadPool>> *myPools) {
-  auto processing = processing_entry;
+Step OProcessor(std::shared_ptr<ProcessingParams> &processing) {
 
   LOG(debug) << "Processor: Processing data from file: " << processing->srcFile << std::endl;
 
-  ImageBuf *input_buf = processing->image.get();
-
-  // auto [process_ok, out_buf] = imgProcessor(*image_buf, procGlobals.ocio_conf_ptr.get(), &settings.dLutPreset,
-  // processing_entry, image, nullptr, nullptr); if (!process_ok) {
-  //     LOG(error) << "Error processing " << processing->srcFile << std::endl;
-  //     //mainWindow->emitUpdateTextSignal("Error! Check console for details");
-  //     return;
-  // }
-  ImageBuf out_buf; // result_buf, rgba_buf, original_alpha, bit_alpha_buf;
-  ImageBuf lut_buf;
-  ImageBuf uns_buf;
-  ImageBuf *out_buf_ptr = &out_buf;
-  ImageBuf *lut_buf_ptr = &lut_buf;
-  ImageBuf *uns_buf_ptr = &uns_buf;
-  // LUT Transform
-  bool lutValid = false;
-  // check if lut_preset is not nullptr set lutValid to true
-  if (settings.dLutPreset != "") {
-    lutValid = true;
-  }
-  // auto test = input_buf.spec();
-  // std::cout << test.width << " " << test.height << " " << test.nchannels << std::endl;
-  LOG(trace) << "Input image: " << input_buf->spec().width << "x" << input_buf->spec().height << "x"
-             << input_buf->spec().nchannels << std::endl;
-  LOG(trace) << "Input image: " << input_buf->spec().format << std::endl;
-
-  if (settings.lutMode >= 0 && lutValid) {
-    auto lutPreset = settings.lut_Preset[settings.dLutPreset];
-    if (ImageBufAlgo::ociofiletransform(
-            *lut_buf_ptr, *input_buf, lutPreset, false, false, procGlobals.ocio_conf_ptr.get())) {
-      LOG(info) << "LUT preset " << settings.dLutPreset << " <" << lutPreset << "> "
-                << " applied" << std::endl;
-      processing_entry->setStatus(ProcessingStatus::Graded);
-      input_buf->clear();
-    } else {
-      LOG(error) << "LUT not applied: " << lut_buf.geterror() << std::endl;
-      lut_buf_ptr = &*input_buf;
-    }
-  } else {
-    LOG(debug) << "LUT transformation disabled" << std::endl;
-    lut_buf_ptr = &*input_buf;
-  }
-
-  (*fileCntr)--;
-  // Apply denoise
-  // Apply unsharp mask
-
-  if (settings.sharp_mode != -1) {
-    string_view kernel = settings.sharp_kerns[settings.sharp_kernel];
-    float width = settings.sharp_width;
-    float contrast = settings.sharp_contrast;
-    float threshold = settings.sharp_tresh;
-    if (ImageBufAlgo::unsharp_mask(*uns_buf_ptr, *lut_buf_ptr, kernel, width, contrast, threshold)) {
-      LOG(debug) << "Unsharp mask applied: <" << kernel.c_str() << ">" << std::endl;
-      processing_entry->setStatus(ProcessingStatus::Unsharped);
-      lut_buf_ptr->clear();
-    } else {
-      LOG(error) << "Unsharp mask not applied: " << uns_buf.geterror() << std::endl;
-      uns_buf_ptr = lut_buf_ptr;
-    }
-  } else {
-    LOG(debug) << "Unsharp mask disabled" << std::endl;
-    uns_buf_ptr = lut_buf_ptr;
+  auto [process_ok, out_buf] = imgProcessor(
+      *processing->image, procGlobals.ocio_conf_ptr.get(), &settings.dLutPreset, processing, nullptr);
+  if (!process_ok) {
+    LOG(error) << "Error processing " << processing->srcFile << std::endl;
+    return Step::failed();
   }
 
-  // temp copy for saving
-  out_buf_ptr = uns_buf_ptr;
-  // raw->dcraw_clear_mem(image);
-  // raw->recycle();
-  // image_buf.clear();
-
-  processing->image = std::make_shared<ImageBuf>(*out_buf_ptr);
-  processing->outSpec = std::make_shared<OIIO::ImageSpec>(out_buf_ptr->spec());
+  processing->image = std::move(out_buf);
+  processing->outSpec = std::make_shared<OIIO::ImageSpec>(processing->image->spec());
 
   processing->setStatus(ProcessingStatus::Processed);
 
-  (*fileCntr)--;
-
-  (*myPools)["writer"]->enqueue(Writer, index, processing_entry, fileCntr, myPools);
+  return Step::to(Stage::Writer);
 }
 
-void Writer(int index,
-            std::shared_ptr<ProcessingParams> &processing_entry,
-            std::atomic_size_t *fileCntr,
-            std::map<std::string, std::unique_ptr<ThreadPool>> *myPools) {
-  auto processing = processing_entry;
-  // LibRaw& raw = processing->raw_data;
-  std::shared_ptr<LibRaw> raw = processing->raw_data;
-
+// Output directory of the file, created on first use and cleared of partial files a killed run left behind
+static bool outputDir(const std::shared_ptr<ProcessingParams> &processing, std::string &outDir) {
   // Check if the output path exists and create it if not
-  std::string outDir = outpaths.get_path(processing->outPathIdx);
+  outDir = outpaths.get_path(processing->outPathIdx);
   if (!outpaths.get_path_status(processing->outPathIdx)) {
     // check if outFilePath folder exists
-    QDir dir(QString::fromStdString(outDir));
-    if (!dir.exists()) {
-      dir.mkpath(".");
-    }
+    std::error_code ec;
+    std::filesystem::create_directories(outDir, ec);
     outpaths.set_path_status(processing->outPathIdx, true);
+    sweepPartials(outDir);
   }
+  return makePath(outDir);
+}
+
+// Remembers the output in its folder's manifest, the source is hashed from memory when a reader still holds it
+static void recordOutput(const std::shared_ptr<ProcessingParams> &processing,
+                         const std::string &outDir,
+                         const std::string &outFilePath) {
+  uint64_t srcHash = 0;
+  if (processing->raw_map && processing->raw_map->isOpen()) {
+    srcHash = hashBytes(processing->raw_map->data(), processing->raw_map->size());
+  } else if (processing->raw_buffer) {
+    srcHash = hashBytes(processing->raw_buffer->data(), processing->raw_buffer->size());
+  }
+  std::string output = std::filesystem::u8path(outFilePath).filename().u8string();
+  procGlobals.manifest.record(outDir, processing->outFile, output, processing->srcFile, processing->fingerprint,
+                              srcHash);
+}
+
+Step Writer(std::shared_ptr<ProcessingParams> &processing) {
+  // LibRaw& raw = processing->raw_data;
+  std::shared_ptr<LibRaw> raw = processing->raw_data;
 
+  std::string outDir;
+  bool dir_ok = outputDir(processing, outDir);
   std::string outFilePath = outDir + "/" + processing->outFile + processing->outExt;
 
-  if (!makePath(outDir)) {
+  if (!dir_ok) {
     LOG(error) << "Writer: Cannot create output directory" << outFilePath << std::endl;
-    return;
+    return Step::failed();
   };
 
   LOG(info) << "Writer: Writing data to file: " << outFilePath << std::endl;
-  if (settings.dDemosaic == -2) {
-    // Write raw data to a file
-    // TODO: move this to OIIO writer to fix file format issue and byte order
-    outFilePath = outDir + "/" + processing->outFile + ".ppm";
-    std::ofstream output(outFilePath, std::ios::binary); // hack to add .ppm extension
-    if (!output) {
-      LOG(error) << "Writer: Cannot open output file " << outFilePath << std::endl;
-      return;
-    }
-
-    size_t pix_count = raw->imgdata.sizes.raw_width * raw->imgdata.sizes.raw_height;
-    size_t raw_image_size = pix_count * sizeof(ushort);
-
-    // Write PGM header
-    output << "P5\n";
-    output << raw->imgdata.sizes.raw_width << " " << raw->imgdata.sizes.raw_height << "\n";
-    output << "65535\n"; // Max value for 16-bit data
-
-    // Write raw data
-    // output.write(reinterpret_cast<char*>(raws[pair.first].imgdata.rawdata.raw_image), raw_image_size);
-
-    // Write raw data with swapped byte order
-    for (size_t i = 0; i < pix_count; ++i) {
-      ushort value = raw->imgdata.rawdata.raw_image[i];
-      value = (value << 8) | (value >> 8); // Swap bytes
-      output.write(reinterpret_cast<char *>(&value), sizeof(ushort));
-    }
-
-    output.close();
-  } else if (settings.dDemosaic == -1) // writing color ppm/tiff using dcraw_ppm_tiff_writer
+  if (settings.dDemosaic == -1) // writing color ppm/tiff using dcraw_ppm_tiff_writer
   {
     if (settings.fileFormat == -1) {
       if (settings.defFormat == 0) {
@@ -787,51 +586,98 @@ void Writer(int index,
       }
     }
 
-    int ret = raw->dcraw_ppm_tiff_writer(outFilePath.c_str());
+    std::string partial = partialPath(outFilePath);
+    int ret = raw->dcraw_ppm_tiff_writer(partial.c_str());
     if (ret != LIBRAW_SUCCESS) {
       LOG(error) << "Writer: Cannot write image to file " << outFilePath << std::endl;
-      processing->raw_data.reset();
-      return;
+      discardOutput(partial);
+      return Step::failed();
+    }
+    if (!commitOutput(partial, outFilePath)) {
+      return Step::failed();
     }
   } else { // Write processed image using oiio
     //////////////////////////////////////////////////
     /// Image saving
     ///
 
-    bool write_ok = img_write(processing->image, outFilePath, TypeDesc::UINT16, TypeDesc::UINT16, nullptr, nullptr);
+    std::string partial = partialPath(outFilePath);
+    bool write_ok =
+        img_write(processing->image, partial, TypeDesc::UINT16, TypeDesc::UINT16, &processing->bytesCopied);
     if (!write_ok) {
       LOG(error) << "Error writing " << outFilePath << std::endl;
       // mainWindow->emitUpdateTextSignal("Error! Check console for details");
-      return;
+      discardOutput(partial);
+      return Step::failed();
     }
-
-    if (!processing->rawCleared) {
-      processing->raw_data->dcraw_clear_mem(processing->raw_image);
-      processing->rawCleared = true;
+    if (!commitOutput(partial, outFilePath)) {
+      return Step::failed();
     }
 
     processing->image->reset();
     processing->image.reset();
+    processing->buffers.clear();
+    processing->clearRawImage();
     //////////////////////////////////////////////////
   }
 
   processing->setStatus(ProcessingStatus::Written);
   LOG(debug) << "Writer: Finished writing data to file: " << outFilePath << std::endl;
   processing->raw_data.reset();
+  recordOutput(processing, outDir, outFilePath);
+
+  return Step::done();
+}
+
+// Undemosaiced sensor data: 16-bit TIFF when the output format is TIFF, big-endian PGM otherwise
+Step RawDump(std::shared_ptr<ProcessingParams> &processing) {
+  std::shared_ptr<LibRaw> raw = processing->raw_data;
+  const ushort *raw_image = raw->imgdata.rawdata.raw_image;
+  if (raw_image == nullptr) {
+    LOG(error) << "RawDump: No single channel raw data in file: " << processing->srcFile << std::endl;
+    return Step::failed();
+  }
 
-  (*fileCntr)--;
+  std::string outDir;
+  if (!outputDir(processing, outDir)) {
+    LOG(error) << "RawDump: Cannot create output directory" << outDir << std::endl;
+    return Step::failed();
+  }
+
+  size_t width = raw->imgdata.sizes.raw_width;
+  size_t height = raw->imgdata.sizes.raw_height;
+  size_t pitch = raw->imgdata.sizes.raw_pitch ? raw->imgdata.sizes.raw_pitch : width * sizeof(ushort);
+
+  bool tiff = processing->outExt == ".tif" || processing->outExt == ".tiff";
+  std::string outFilePath = outDir + "/" + processing->outFile + (tiff ? processing->outExt : ".ppm");
+  LOG(info) << "RawDump: Writing raw data to file: " << outFilePath << std::endl;
+
+  unrw::Timer timer;
+  std::string partial = partialPath(outFilePath);
+  bool ok = tiff ? writeRawTIFF(partial, raw_image, width, height, pitch)
+                 : writeRawPGM(partial, raw_image, width, height, pitch);
+  if (!ok) {
+    LOG(error) << "RawDump: Cannot write raw data to file " << outFilePath << std::endl;
+    discardOutput(partial);
+    return Step::failed();
+  }
+  if (!commitOutput(partial, outFilePath)) {
+    return Step::failed();
+  }
+  LOG(debug) << "RawDump: " << width << "x" << height << " written in " << timer << std::endl;
+
+  processing->setStatus(ProcessingStatus::Written);
+  processing->raw_data.reset();
+  recordOutput(processing, outDir, outFilePath);
+  return Step::done();
 }
 
-void Dummy(int index,
-           std::shared_ptr<ProcessingParams> &processing_entry,
-           std::atomic_size_t *fileCntr,
-           std::map<std::string, std::unique_ptr<ThreadPool>> *myPools) {
-  auto processing = processing_entry;
+Step Dummy(std::shared_ptr<ProcessingParams> &processing) {
 
   if (!processing->rawCleared) {
     processing->raw_data->dcraw_clear_mem(processing->raw_image);
     processing->rawCleared = true;
   }
 
-  (*fileCntr)--;
+  return Step::done();
 }
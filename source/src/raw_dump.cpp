@@ -0,0 +1,114 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+#include <OpenImageIO/imageio.h>
+
+#include "unrawer/log.hpp"
+#include "unrawer/raw_dump.hpp"
+#include "unrawer/simd.hpp"
+
+// Bytes handed to a single write call
+static constexpr size_t kWriteBlock = size_t(4) << 20;
+
+#if defined(UNRAWER_SIMD_X86)
+// 16 values per step, one byte shuffle per 256-bit register
+UNRAWER_TARGET_AVX2 static size_t byteSwap16AVX2(const uint16_t *src, uint16_t *dst, size_t count) {
+  const __m256i order = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                         1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_shuffle_epi8(v, order));
+  }
+  return i;
+}
+#endif
+
+void byteSwap16(const uint16_t *src, uint16_t *dst, size_t count) {
+  size_t i = 0;
+#if defined(UNRAWER_SIMD_X86)
+  if (cpuHasAVX2()) {
+    i = byteSwap16AVX2(src, dst, count);
+  }
+  for (; i + 8 <= count; i += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), v);
+  }
+#elif defined(UNRAWER_SIMD_NEON)
+  for (; i + 8 <= count; i += 8) {
+    uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t *>(src + i));
+    vst1q_u8(reinterpret_cast<uint8_t *>(dst + i), vrev16q_u8(v));
+  }
+#endif
+  for (; i < count; ++i) {
+    dst[i] = static_cast<uint16_t>((src[i] << 8) | (src[i] >> 8));
+  }
+}
+
+bool writeRawPGM(const std::string &path, const uint16_t *data, size_t width, size_t height, size_t pitch) {
+  std::ofstream output;
+  output.rdbuf()->pubsetbuf(nullptr, 0); // blocks go straight to the file, no copy into the stream buffer
+  output.open(path, std::ios::binary);
+  if (!output) {
+    return false;
+  }
+
+  // Write PGM header
+  output << "P5\n" << width << " " << height << "\n65535\n"; // Max value for 16-bit data
+
+  // Reused by every file dumped on this thread
+  static thread_local std::vector<uint16_t> swapped;
+  size_t rowsPerBlock = std::max<size_t>(1, kWriteBlock / (width * sizeof(uint16_t)));
+  swapped.resize(rowsPerBlock * width);
+
+  const char *base = reinterpret_cast<const char *>(data);
+  for (size_t y = 0; y < height && output; y += rowsPerBlock) {
+    size_t rows = std::min(rowsPerBlock, height - y);
+    for (size_t r = 0; r < rows; ++r) {
+      byteSwap16(reinterpret_cast<const uint16_t *>(base + (y + r) * pitch), swapped.data() + r * width, width);
+    }
+    output.write(reinterpret_cast<const char *>(swapped.data()),
+                 static_cast<std::streamsize>(rows * width * sizeof(uint16_t)));
+  }
+  output.close();
+  return !output.fail();
+}
+
+bool writeRawTIFF(const std::string &path, const uint16_t *data, size_t width, size_t height, size_t pitch) {
+  auto out = OIIO::ImageOutput::create(path);
+  if (!out) {
+    LOG(error) << "RawDump: " << OIIO::geterror() << std::endl;
+    return false;
+  }
+  OIIO::ImageSpec spec(static_cast<int>(width), static_cast<int>(height), 1, OIIO::TypeDesc::UINT16);
+  spec.attribute("compression", "none");
+  spec.attribute("tiff:RowsPerStrip", static_cast<int>(std::max<size_t>(1, kWriteBlock / (width * 2))));
+  if (!out->open(path, spec)) {
+    LOG(error) << "RawDump: " << out->geterror() << std::endl;
+    return false;
+  }
+  bool ok = out->write_image(OIIO::TypeDesc::UINT16, data, sizeof(uint16_t), static_cast<OIIO::stride_t>(pitch));
+  if (!ok) {
+    LOG(error) << "RawDump: " << out->geterror() << std::endl;
+  }
+  return out->close() && ok;
+}
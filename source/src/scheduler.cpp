@@ -0,0 +1,404 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <sstream>
+
+#include "unrawer/log.hpp"
+#include "unrawer/scheduler.hpp"
+
+// Scheduler and index of the worker running on the current thread, nullptr for non-worker threads
+static thread_local Scheduler *tls_scheduler = nullptr;
+static thread_local size_t tls_worker = 0;
+
+const char *stageName(Stage stage) {
+  switch (stage) {
+  case Stage::Sorter:
+    return "sorter";
+  case Stage::Reader:
+    return "reader";
+  case Stage::Unpacker:
+    return "unpacker";
+  case Stage::Demosaic:
+    return "demosaic";
+  case Stage::Dcraw:
+    return "dcraw";
+  case Stage::Processor:
+    return "processor";
+  case Stage::Writer:
+    return "writer";
+  case Stage::RawDump:
+    return "rawdump";
+  default:
+    return "unknown";
+  }
+}
+
+size_t Scheduler::currentWorker() { return tls_scheduler ? tls_worker : SIZE_MAX; }
+
+Scheduler *Scheduler::current() { return tls_scheduler; }
+
+Scheduler::Scheduler(size_t threads) {
+  if (threads == 0) {
+    threads = 1;
+  }
+  for (size_t s = 0; s < kStageCount; ++s) {
+    stage_queued[s] = 0;
+    stage_running[s] = 0;
+    stage_completed[s] = 0;
+    stage_busy_ns[s] = 0;
+    stage_limit[s] = threads;
+  }
+  for (size_t i = 0; i < threads; ++i) {
+    queues.emplace_back(std::make_unique<WorkerQueues>());
+  }
+  // Queues must exist before the first worker starts stealing
+  for (size_t i = 0; i < threads; ++i) {
+    workers.emplace_back([this, i] { workerLoop(i); });
+  }
+}
+
+Scheduler::~Scheduler() {
+  if (balancer.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(balancer_mutex);
+      balancer_stop = true;
+    }
+    balancer_cv.notify_all();
+    balancer.join();
+  }
+  {
+    std::lock_guard<std::mutex> lock(park_mutex);
+    stop = true;
+  }
+  park_cv.notify_all();
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+}
+
+void Scheduler::push(Stage stage, Task task) {
+  size_t s = static_cast<size_t>(stage);
+  size_t target = (tls_scheduler == this) ? tls_worker : next_queue.fetch_add(1) % queues.size();
+
+  ++inflight;
+  ++stage_queued[s]; // counted before the task is visible, so it never goes below zero when popped
+  ++queued;
+  {
+    WorkerQueues &wq = *queues[target];
+    std::lock_guard<std::mutex> lock(wq.mtx);
+    wq.tasks[s].push_back(std::move(task));
+    ++wq.count;
+  }
+  wakeWorker();
+}
+
+void Scheduler::wakeWorker() {
+  // Parked workers re-check runnable() under park_mutex, taking the lock here closes the lost wake-up window
+  if (sleeping > 0) {
+    { std::lock_guard<std::mutex> lock(park_mutex); }
+    park_cv.notify_one();
+  }
+}
+
+bool Scheduler::claim(size_t s) {
+  size_t running = stage_running[s];
+  while (running < stage_limit[s]) {
+    if (stage_running[s].compare_exchange_weak(running, running + 1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Scheduler::runnable() const {
+  if (open_jobs > 0) {
+    return true;
+  }
+  for (size_t s = 0; s < kStageCount; ++s) {
+    if (stage_queued[s] > 0 && stage_running[s] < stage_limit[s]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Scheduler::setStageLimit(Stage stage, size_t limit) {
+  stage_limit[static_cast<size_t>(stage)] = std::clamp<size_t>(limit, 1, workers.size());
+  { std::lock_guard<std::mutex> lock(park_mutex); }
+  park_cv.notify_all();
+}
+
+bool Scheduler::popLocal(size_t self, Task &task, Stage &stage) {
+  WorkerQueues &wq = *queues[self];
+  if (wq.count == 0) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(wq.mtx);
+  for (size_t s = kStageCount; s-- > 0;) {
+    if (!wq.tasks[s].empty() && claim(s)) {
+      task = std::move(wq.tasks[s].back());
+      wq.tasks[s].pop_back();
+      --wq.count;
+      stage = static_cast<Stage>(s);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Scheduler::steal(size_t self, Task &task, Stage &stage) {
+  size_t n = queues.size();
+  for (size_t k = 1; k < n; ++k) {
+    WorkerQueues &wq = *queues[(self + k) % n];
+    if (wq.count == 0) {
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(wq.mtx);
+    for (size_t s = kStageCount; s-- > 0;) {
+      if (!wq.tasks[s].empty() && claim(s)) {
+        task = std::move(wq.tasks[s].front());
+        wq.tasks[s].pop_front();
+        --wq.count;
+        stage = static_cast<Stage>(s);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void Scheduler::execute(Stage stage, Task &task) {
+  size_t s = static_cast<size_t>(stage);
+  --queued;
+  --stage_queued[s]; // the running slot was taken by claim()
+
+  auto start = std::chrono::steady_clock::now();
+  try {
+    task();
+  } catch (const std::exception &e) {
+    LOG(error) << "Scheduler: " << stageName(stage) << " task failed: " << e.what() << std::endl;
+  } catch (...) {
+    LOG(error) << "Scheduler: " << stageName(stage) << " task failed with unknown exception" << std::endl;
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  stage_busy_ns[s] += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  --stage_running[s];
+  ++stage_completed[s];
+  if (stage_queued[s] > 0) {
+    wakeWorker(); // a worker may be parked on this stage's limit
+  }
+
+  task = nullptr; // release captured state before signalling completion
+  if (--inflight == 0) {
+    std::lock_guard<std::mutex> lock(done_mutex);
+    done_cv.notify_all();
+  }
+}
+
+void Scheduler::runChunks(ForJob &job) {
+  for (size_t i; (i = job.next.fetch_add(1)) < job.n;) {
+    try {
+      (*job.fn)(i);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(job.mtx);
+      if (!job.error) {
+        job.error = std::current_exception();
+      }
+    }
+    if (++job.done == job.n) {
+      std::lock_guard<std::mutex> lock(job.mtx);
+      job.finished.notify_all();
+    }
+  }
+}
+
+bool Scheduler::help() {
+  if (open_jobs == 0) {
+    return false;
+  }
+  std::shared_ptr<ForJob> job;
+  {
+    std::lock_guard<std::mutex> lock(jobs_mutex);
+    while (!jobs.empty() && jobs.front()->next >= jobs.front()->n) {
+      jobs.pop_front(); // every chunk claimed, whoever runs the last one wakes the caller
+      --open_jobs;
+    }
+    if (jobs.empty()) {
+      return false;
+    }
+    job = jobs.front();
+  }
+  runChunks(*job);
+  return true;
+}
+
+void Scheduler::parallelFor(size_t n, const std::function<void(size_t)> &fn) {
+  auto job = std::make_shared<ForJob>();
+  job->fn = &fn;
+  job->n = n;
+  bool shared = n > 1 && workers.size() > 1;
+  if (shared) {
+    {
+      std::lock_guard<std::mutex> lock(jobs_mutex);
+      jobs.push_back(job);
+      ++open_jobs;
+    }
+    { std::lock_guard<std::mutex> lock(park_mutex); }
+    park_cv.notify_all();
+  }
+
+  runChunks(*job);
+  {
+    std::unique_lock<std::mutex> lock(job->mtx);
+    job->finished.wait(lock, [&job] { return job->done == job->n; });
+  }
+  if (shared) {
+    std::lock_guard<std::mutex> lock(jobs_mutex);
+    auto it = std::find(jobs.begin(), jobs.end(), job);
+    if (it != jobs.end()) {
+      jobs.erase(it);
+      --open_jobs;
+    }
+  }
+  if (job->error) {
+    std::rethrow_exception(job->error);
+  }
+}
+
+void Scheduler::workerLoop(size_t self) {
+  tls_scheduler = this;
+  tls_worker = self;
+
+  for (;;) {
+    if (help()) {
+      continue; // chunks of an image in flight come before new stage work
+    }
+    Task task;
+    Stage stage;
+    if (popLocal(self, task, stage) || steal(self, task, stage)) {
+      execute(stage, task);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(park_mutex);
+    ++sleeping;
+    park_cv.wait(lock, [this] { return stop || runnable(); });
+    --sleeping;
+    if (stop && queued == 0) {
+      return; // Exit the thread when Scheduler is stopped and drained
+    }
+  }
+}
+
+void Scheduler::waitForAllTasks() {
+  std::unique_lock<std::mutex> lock(done_mutex);
+  done_cv.wait(lock, [this] { return inflight == 0; });
+}
+
+StageStats Scheduler::stats(Stage stage) const {
+  size_t s = static_cast<size_t>(stage);
+  return {stage_queued[s],
+          stage_running[s],
+          stage_completed[s],
+          static_cast<double>(stage_busy_ns[s]) * 1e-9,
+          stage_limit[s]};
+}
+
+void Scheduler::startBalancer(std::chrono::milliseconds interval) {
+  if (!balancer.joinable() && workers.size() > 1) {
+    balancer = std::thread([this, interval] { balancerLoop(interval); });
+  }
+}
+
+void Scheduler::balancerLoop(std::chrono::milliseconds interval) {
+  const double window = std::chrono::duration<double>(interval).count();
+  std::array<size_t, kStageCount> lastCompleted{};
+  std::array<int64_t, kStageCount> lastBusy{};
+  std::array<double, kStageCount> taskSec{}; // smoothed execution time per task
+
+  std::unique_lock<std::mutex> lock(balancer_mutex);
+  while (!balancer_cv.wait_for(lock, interval, [this] { return balancer_stop; })) {
+    std::array<double, kStageCount> load{}; // average busy workers over the window
+    size_t bottleneck = kStageCount;
+    double worstWait = 0.0;
+
+    for (size_t s = 0; s < kStageCount; ++s) {
+      size_t completed = stage_completed[s];
+      int64_t busy = stage_busy_ns[s];
+      double busySec = static_cast<double>(busy - lastBusy[s]) * 1e-9;
+      if (completed > lastCompleted[s]) {
+        double sample = busySec / static_cast<double>(completed - lastCompleted[s]);
+        taskSec[s] = taskSec[s] > 0.0 ? 0.5 * (taskSec[s] + sample) : sample;
+      }
+      lastCompleted[s] = completed;
+      lastBusy[s] = busy;
+      // Busy time is booked when a task ends, long tasks still running count as fully busy
+      load[s] = std::max(busySec / window, static_cast<double>(stage_running[s]));
+
+      // Congested: work is waiting and the stage is held back by its own limit, not by a lack of workers
+      size_t limit = stage_limit[s];
+      size_t waiting = stage_queued[s];
+      if (waiting > 0 && stage_running[s] >= limit && limit < workers.size()) {
+        double wait = static_cast<double>(waiting) * std::max(taskSec[s], 1e-3) / static_cast<double>(limit);
+        if (wait > worstWait) {
+          worstWait = wait;
+          bottleneck = s;
+        }
+      }
+    }
+    if (bottleneck == kStageCount) {
+      continue;
+    }
+
+    // Donor: no backlog and the most limit it did not use during the window
+    size_t donor = kStageCount;
+    double mostSpare = 0.0;
+    for (size_t s = 0; s < kStageCount; ++s) {
+      if (s == bottleneck || stage_limit[s] <= 1 || stage_queued[s] > 0) {
+        continue;
+      }
+      double spare = static_cast<double>(stage_limit[s]) - std::ceil(load[s]);
+      if (spare >= 1.0 && spare > mostSpare) {
+        mostSpare = spare;
+        donor = s;
+      }
+    }
+    if (donor == kStageCount) {
+      continue;
+    }
+
+    --stage_limit[donor];
+    ++stage_limit[bottleneck];
+    LOG(info) << "Scheduler: rebalance +1 " << stageName(static_cast<Stage>(bottleneck)) << " (limit "
+              << stage_limit[bottleneck] << ", " << stage_queued[bottleneck] << " queued, "
+              << taskSec[bottleneck] * 1000.0 << " ms/task) -1 " << stageName(static_cast<Stage>(donor))
+              << " (limit " << stage_limit[donor] << ", load " << load[donor] << ")" << std::endl;
+    { std::lock_guard<std::mutex> park(park_mutex); }
+    park_cv.notify_all();
+  }
+
+  std::ostringstream limits;
+  for (size_t s = 0; s < kStageCount; ++s) {
+    limits << (s ? ", " : "") << stageName(static_cast<Stage>(s)) << " " << stage_limit[s];
+  }
+  LOG(info) << "Scheduler: stage limits settled at " << limits.str() << std::endl;
+}
@@ -19,6 +19,9 @@
 #include "unrawer/settings.hpp"
 #include "unrawer/log.hpp"
 #include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
 #include <toml.hpp>
 
 Settings settings;
@@ -35,10 +38,32 @@ bool isValidPath(const std::string &path) {
   return true;
 }
 
-bool loadSettings(Settings &settings, const std::string &filename) {
+bool loadSettings(Settings &settings, const std::string &filename, const std::vector<std::string> &overrides) {
   try {
     auto parsed = toml::parse(filename);
 
+    // "Section.Key=value" entries replace what the file says. Values are TOML, anything that is not valid TOML is
+    // taken as a plain string, so paths need no quoting.
+    for (const std::string &entry : overrides) {
+      size_t dot = entry.find('.');
+      size_t eq = entry.find('=');
+      if (dot == std::string::npos || eq == std::string::npos || dot > eq) {
+        LOG(error) << "Error in setting override \"" << entry << "\": expected Section.Key=value" << std::endl;
+        return false;
+      }
+      std::string section = entry.substr(0, dot);
+      std::string key = entry.substr(dot + 1, eq - dot - 1);
+      std::string text = entry.substr(eq + 1);
+      toml::value value;
+      try {
+        std::istringstream in("v = " + text);
+        value = toml::parse(in, "override").at("v");
+      } catch (const std::exception &) {
+        value = toml::value(text);
+      }
+      parsed[section][key] = value;
+    }
+
     if (!parsed.contains("Global") || parsed["Global"].as_table().empty()) {
       LOG(error) << "Error parsing settings file: [Global] section not found or empty." << std::endl;
       return false;
@@ -84,6 +109,11 @@ bool loadSettings(Settings &settings, const std::string &filename) {
       }
       return true;
     };
+    // Keys added after the first release: a missing key silently means its default, also when a reload drops it
+    const Settings defaults;
+    auto optional = [&parsed](const std::string &section, const std::string &key) {
+      return parsed[section].contains(key);
+    };
     // Global
     if (!check("Global", "Console"))
       return false;
@@ -101,6 +131,66 @@ bool loadSettings(Settings &settings, const std::string &filename) {
       return false;
     }
 
+    // Optional, older configs run the staged pipeline
+    settings.pipelineMode = defaults.pipelineMode;
+    if (optional("Global", "PipelineMode")) {
+      settings.pipelineMode = parsed["Global"]["PipelineMode"].as_integer();
+      if (settings.pipelineMode > 1) {
+        LOG(error) << "Error parsing settings file: [Global] section: \"PipelineMode\" key value is out of range."
+                   << std::endl;
+        return false;
+      }
+    }
+
+    settings.readAhead = defaults.readAhead;
+    if (optional("Global", "ReadAhead")) {
+      settings.readAhead = parsed["Global"]["ReadAhead"].as_integer();
+      if (settings.readAhead < 1 || settings.readAhead > 256) {
+        LOG(error) << "Error parsing settings file: [Global] section: \"ReadAhead\" key value is out of range."
+                   << std::endl;
+        return false;
+      }
+    }
+
+    // Optional, no limit when missing
+    settings.memLimit = defaults.memLimit;
+    if (optional("Global", "MemoryLimit")) {
+      auto memLimit = parsed["Global"]["MemoryLimit"].as_integer();
+      if (memLimit < 0) {
+        LOG(error) << "Error parsing settings file: [Global] section: \"MemoryLimit\" key value should not be negative."
+                   << std::endl;
+        return false;
+      }
+      settings.memLimit = static_cast<uint>(memLimit);
+    }
+
+    // Optional, default pool when missing
+    settings.poolCache = defaults.poolCache;
+    if (optional("Global", "BufferPool")) {
+      auto poolCache = parsed["Global"]["BufferPool"].as_integer();
+      if (poolCache < 0) {
+        LOG(error) << "Error parsing settings file: [Global] section: \"BufferPool\" key value should not be negative."
+                   << std::endl;
+        return false;
+      }
+      settings.poolCache = static_cast<uint>(poolCache);
+    }
+    settings.hugePages = defaults.hugePages;
+    if (optional("Global", "HugePages")) {
+      settings.hugePages = parsed["Global"]["HugePages"].as_boolean();
+    }
+
+    // Optional, memory-mapped when missing
+    settings.readMode = defaults.readMode;
+    if (optional("Global", "ReadMode")) {
+      settings.readMode = parsed["Global"]["ReadMode"].as_integer();
+      if (settings.readMode > 2) {
+        LOG(error) << "Error parsing settings file: [Global] section: \"ReadMode\" key value is out of range."
+                   << std::endl;
+        return false;
+      }
+    }
+
     if (!check("Global", "ExportSubf"))
       return false;
     settings.useSbFldr = parsed["Global"]["ExportSubf"].as_boolean();
@@ -167,6 +257,11 @@ bool loadSettings(Settings &settings, const std::string &filename) {
                  << std::endl;
       return false;
     }
+    // Optional, older configs skip up to date files
+    settings.skipUpToDate = defaults.skipUpToDate;
+    if (optional("Export", "SkipUpToDate")) {
+      settings.skipUpToDate = parsed["Export"]["SkipUpToDate"].as_boolean();
+    }
     // CameraRaw
     if (!check("CameraRaw", "RawRotation"))
       return false;
@@ -346,96 +441,116 @@ bool loadSettings(Settings &settings, const std::string &filename) {
 }
 
 void printSettings(Settings &settings) {
-  QString mode;
-  qDebug() << "--------- Settings ---------";
+  // Written to stderr like qDebug() did, the window and the command line runner both show it on the console
+  std::ostream &out = std::cerr;
+  out << "--------- Settings ---------" << std::endl;
 
-  qDebug() << "Parallel Threads: " << settings.numThreads;
-  qDebug() << "Threads multiplier: " << settings.mltThreads;
+  out << "Parallel Threads: " << settings.numThreads << std::endl;
+  out << "Threads multiplier: " << settings.mltThreads << std::endl;
+  out << "Pipeline mode: " << (settings.pipelineMode == 1 ? "fused" : "staged") << std::endl;
+  auto getReadMode = [](uint readMode) {
+    switch (readMode) {
+    case 1:
+      return "memory-mapped";
+    case 2:
+      return "async io_uring";
+    default:
+      return "LibRaw file I/O";
+    }
+  };
+  out << "Read mode: " << getReadMode(settings.readMode) << std::endl;
+  if (settings.readMode == 2) {
+    out << "Read ahead: " << settings.readAhead << std::endl;
+  }
+  out << "Memory limit: "
+      << (settings.memLimit == 0 ? std::string("unlimited") : std::to_string(settings.memLimit) + " MB") << std::endl;
+  out << "Buffer pool: "
+      << (settings.poolCache == 0 ? std::string("disabled") : std::to_string(settings.poolCache) + " MB")
+      << (settings.poolCache > 0 && settings.hugePages ? ", huge pages" : "") << std::endl;
 
-  qDebug() << qPrintable(QString("Range Mode: %1").arg(mode));
+  out << "Range Mode: " << std::endl;
 
   auto getMode = [](int fileFormat) {
     switch (fileFormat) {
     case 0:
-      return QString("TIFF");
+      return "TIFF";
     case 1:
-      return QString("OpenEXR");
+      return "OpenEXR";
     case 2:
-      return QString("PNG");
+      return "PNG";
     case 3:
-      return QString("JPEG");
+      return "JPEG";
     case 4:
-      return QString("JPEG-2000");
+      return "JPEG-2000";
     case 5:
-      return QString("PPM");
+      return "PPM";
     default:
-      return QString("Same as input");
+      return "Same as input";
     }
   };
-  qDebug() << qPrintable(QString("File Format: %1").arg(getMode(settings.fileFormat)));
-  qDebug() << qPrintable(QString("Default File Format: %1").arg(getMode(settings.defFormat)));
+  out << "File Format: " << getMode(settings.fileFormat) << std::endl;
+  out << "Default File Format: " << getMode(settings.defFormat) << std::endl;
 
   auto getBitDepth = [](int bitDepth) {
     switch (bitDepth) {
     case 0:
-      return QString("uint8");
+      return "uint8";
     case 1:
-      return QString("uint16");
+      return "uint16";
     case 2:
-      return QString("uint32");
+      return "uint32";
     case 3:
-      return QString("uint64");
+      return "uint64";
     case 4:
-      return QString("16bit (half) float");
+      return "16bit (half) float";
     case 5:
-      return QString("32bit float");
+      return "32bit float";
     case 6:
-      return QString("64bit (double) float");
+      return "64bit (double) float";
     default:
-      return QString("Same as input");
+      return "Same as input";
     }
   };
-  qDebug() << qPrintable(QString("Export Bit Depth: %1").arg(getBitDepth(settings.bitDepth)));
-  qDebug() << qPrintable(QString("Default Export Bit Depth: %1").arg(getBitDepth(settings.defBDepth)));
+  out << "Export Bit Depth: " << getBitDepth(settings.bitDepth) << std::endl;
+  out << "Default Export Bit Depth: " << getBitDepth(settings.defBDepth) << std::endl;
+  out << "Skip up to date files: " << (settings.skipUpToDate ? "enabled" : "disabled") << std::endl;
 
   auto getRawRotation = [](int rawRot) {
     switch (rawRot) {
     case 0:
-      return QString("Unrotated/Horisontal");
+      return "Unrotated/Horisontal";
     case 3:
-      return QString("180 Horisontal");
+      return "180 Horisontal";
     case 5:
-      return QString("90 CW Vertical");
+      return "90 CW Vertical";
     case 6:
-      return QString("90 CCW Vertical");
+      return "90 CCW Vertical";
     default:
-      return QString("Auto EXIF");
+      return "Auto EXIF";
     }
   };
 
-  qDebug() << qPrintable(QString("Raw Rotation: %1").arg(getRawRotation(settings.rawRot)));
-  qDebug() << qPrintable(
-      QString("Half -size raw image: %1").arg(settings.rawParms.half_size == 0 ? "disabled" : "enabled"));
-  qDebug() << qPrintable(
-      QString("Use auto white balance: %1").arg(settings.rawParms.use_auto_wb == 0 ? "disabled" : "enabled"));
-  qDebug() << qPrintable(
-      QString("Use camera white balance: %1").arg(settings.rawParms.use_camera_wb == 0 ? "disabled" : "enabled"));
-  qDebug() << qPrintable(QString("Use camera matrix: %1").arg(settings.rawParms.use_camera_matrix));
-  qDebug() << qPrintable(QString("Highlight mode: %1").arg(settings.rawParms.highlight));
-  qDebug() << qPrintable(QString("Aberrations: %1, %2")
-                             .arg(QString::number(settings.rawParms.aber[0], 'f', 2))
-                             .arg(QString::number(settings.rawParms.aber[1], 'f', 2)));
-  qDebug() << qPrintable(QString("Denoise mode: %1").arg(settings.denoise_mode));
-  qDebug() << qPrintable(QString("Denoise threshold: %1").arg(QString::number(settings.rawParms.denoise_thr, 'f', 2)));
-  qDebug() << qPrintable(QString("FBDD noise reduction: %1").arg(settings.rawParms.fbdd_noiserd));
+  out << "Raw Rotation: " << getRawRotation(settings.rawRot) << std::endl;
+  out << "Half -size raw image: " << (settings.rawParms.half_size == 0 ? "disabled" : "enabled") << std::endl;
+  out << "Use auto white balance: " << (settings.rawParms.use_auto_wb == 0 ? "disabled" : "enabled") << std::endl;
+  out << "Use camera white balance: " << (settings.rawParms.use_camera_wb == 0 ? "disabled" : "enabled")
+      << std::endl;
+  out << "Use camera matrix: " << settings.rawParms.use_camera_matrix << std::endl;
+  out << "Highlight mode: " << settings.rawParms.highlight << std::endl;
+  out << std::fixed << std::setprecision(2);
+  out << "Aberrations: " << settings.rawParms.aber[0] << ", " << settings.rawParms.aber[1] << std::endl;
+  out << "Denoise mode: " << settings.denoise_mode << std::endl;
+  out << "Denoise threshold: " << settings.rawParms.denoise_thr << std::endl;
+  out << std::defaultfloat;
+  out << "FBDD noise reduction: " << settings.rawParms.fbdd_noiserd << std::endl;
 
-  qDebug() << qPrintable(QString("Raw Color Space: %1").arg(settings.rawSpace));
+  out << "Raw Color Space: " << settings.rawSpace << std::endl;
 
   if (settings.pathPrefix != "") {
-    qDebug() << qPrintable(QString("Processed images will be saved to subfolder: %1").arg(settings.pathPrefix.c_str()));
+    out << "Processed images will be saved to subfolder: " << settings.pathPrefix << std::endl;
   }
 
-  qDebug() << qPrintable(QString("OCIO Config: %1").arg(settings.ocioConfigPath.c_str()));
+  out << "OCIO Config: " << settings.ocioConfigPath << std::endl;
 
-  qDebug() << "----------------------------";
+  out << "----------------------------" << std::endl;
 }
@@ -663,6 +663,7 @@ void MainWindow::reloadConfig() {
     LOG(error) << "Can not load [unrw_config.toml] Using default settings." << std::endl;
     settings.reSettings();
   }
+  clearColorCaches(); // the config or the presets may have changed
   printSettings(settings);
 }
 
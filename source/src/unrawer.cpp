@@ -15,6 +15,7 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <filesystem>
 #include <math.h>
 #include <string>
 
@@ -26,133 +27,169 @@
 #include <OpenImageIO/imageio.h>
 
 #include "unrawer/log.hpp"
+#include "unrawer/lut3d.hpp"
 #include "unrawer/unrawer.hpp"
+#include "unrawer/unsharp.hpp"
 // #include "imageio.h"
 #include "unrawer/settings.hpp"
 // #include "processing.h"
 
 using namespace OIIO;
 
+// Moves the result into the shared buffer handed to the Writer. Pixels are only copied when the result is backed by
+// the image cache, the Writer needs them in memory.
+static std::shared_ptr<ImageBuf> handOff(ImageBuf &buf, std::shared_ptr<ProcessingParams> &processing_entry) {
+  if (buf.localpixels() == nullptr && buf.initialized()) {
+    buf.make_writable(true);
+    processing_entry->bytesCopied += buf.spec().image_bytes();
+  }
+  return std::make_shared<ImageBuf>(std::move(buf));
+}
+
+// Relative presets are relative to the OCIO config, like OCIO resolves them
+std::string lutPath(const std::string &preset) {
+  std::filesystem::path path(preset);
+  if (path.is_relative() && !settings.ocioConfigPath.empty()) {
+    return (std::filesystem::path(settings.ocioConfigPath).parent_path() / path).string();
+  }
+  return preset;
+}
+
+// OCIO file transform through the session processor cache, equivalent of ImageBufAlgo::ociofiletransform
+static bool applyOCIO(ImageBuf &dst, const ImageBuf &src, const std::string &lutPreset) {
+  ColorProcessorHandle processor = procGlobals.color_cache.fileTransform(settings.ocioConfigPath, lutPreset);
+  if (!processor) {
+    dst.errorfmt("Could not construct the OCIO file transform {}", lutPreset);
+    return false;
+  }
+  return ImageBufAlgo::colorconvert(dst, src, processor.get(), false);
+}
+
 std::pair<bool, std::shared_ptr<ImageBuf>> imgProcessor(ImageBuf &input_buf,
                                                         ColorConfig *colorconfig,
                                                         std::string *c_lut_preset,
                                                         std::shared_ptr<ProcessingParams> &processing_entry,
-                                                        libraw_processed_image_t *raw_image,
-                                                        QProgressBar *progressBar,
-                                                        MainWindow *mainWindow) {
-
-  ImageBuf out_buf; // result_buf, rgba_buf, original_alpha, bit_alpha_buf;
-  ImageBuf lut_buf;
-  ImageBuf uns_buf;
-  ImageBuf *out_buf_ptr = &out_buf;
-  ImageBuf *lut_buf_ptr = &lut_buf;
-  ImageBuf *uns_buf_ptr = &uns_buf;
+                                                        libraw_processed_image_t *raw_image) {
+
+  // Ping-pong targets: every operation writes into the buffer `cur` is not, the result is moved out at the end.
+  // With a buffer pool the targets wrap recycled blocks, otherwise OIIO allocates them.
+  ImageBuf scratch[2];
+  PooledBuffer mem[2];
+  ImageBuf *cur = &input_buf;
+  int next = 0;
+  auto target = [&]() -> ImageBuf * {
+    if (procGlobals.buffer_pool) {
+      ImageSpec spec = cur->spec();
+      mem[next] = procGlobals.buffer_pool->acquire(spec.image_bytes());
+      if (mem[next]) {
+        scratch[next].reset(spec, mem[next].data());
+      }
+    }
+    return &scratch[next];
+  };
+  auto drop = [&](ImageBuf *dst) {
+    dst->clear();
+    mem[dst - scratch].reset();
+  };
+  auto advance = [&](ImageBuf *dst) {
+    if (dst == cur) {
+      return;
+    }
+    if (cur == &input_buf) {
+      cur->clear();
+      if (raw_image) {
+        processing_entry->clearRawImage(); // input_buf wraps the LibRaw image
+      }
+    } else {
+      drop(cur);
+    }
+    cur = dst;
+    next ^= 1;
+  };
+
   // LUT Transform
   bool lutValid = false;
   // check if lut_preset is not nullptr set lutValid to true
   if (*c_lut_preset != "") {
     lutValid = true;
   }
-  // auto test = input_buf.spec();
-  // std::cout << test.width << " " << test.height << " " << test.nchannels << std::endl;
   LOG(trace) << "Input image: " << input_buf.spec().width << "x" << input_buf.spec().height << "x"
              << input_buf.spec().nchannels << std::endl;
   LOG(trace) << "Input image: " << input_buf.spec().format << std::endl;
 
-  if (settings.lutMode >= 0 && lutValid) {
-    auto lutPreset = settings.lut_Preset[settings.dLutPreset];
-    if (ImageBufAlgo::ociofiletransform(*lut_buf_ptr, input_buf, lutPreset, false, false, colorconfig)) {
+  bool lutEnabled = settings.lutMode >= 0 && lutValid;
+  bool sharpEnabled = settings.sharp_mode != -1;
+  std::string lutPreset = lutEnabled ? settings.lut_Preset[settings.dLutPreset] : std::string();
+  // .cube presets run on the built-in engine, everything else and unsupported pixel formats through the OCIO
+  // processor compiled once per session
+  std::shared_ptr<const Lut3D> lut = lutEnabled ? procGlobals.lut_cache.get(lutPath(lutPreset)) : nullptr;
+  const std::string &kernel = settings.sharp_kerns[settings.sharp_kernel];
+  float width = settings.sharp_width;
+  float contrast = settings.sharp_contrast;
+  float threshold = settings.sharp_tresh;
+
+  // Built-in LUT and separable kernel: grading, sharpening and quantisation in one tiled pass, one read of the
+  // input and one write of the result, no graded intermediate
+  bool fused = false;
+  if (lut && sharpEnabled) {
+    ImageBuf *dst = target();
+    fused = unsharpMask(*dst, *cur, kernel, width, contrast, threshold, lut.get());
+    if (fused) {
       LOG(info) << "LUT preset " << settings.dLutPreset << " <" << lutPreset << "> "
-                << " applied" << std::endl;
+                << " and unsharp mask <" << kernel.c_str() << "> applied in a single pass" << std::endl;
       processing_entry->setStatus(ProcessingStatus::Graded);
-      input_buf.clear();
-      if (!processing_entry->rawCleared) {
-        processing_entry->raw_data->dcraw_clear_mem(raw_image);
-        processing_entry->rawCleared = true;
-      }
+      processing_entry->setStatus(ProcessingStatus::Unsharped);
+      advance(dst);
+    } else {
+      drop(dst);
+    }
+  }
+
+  if (lutEnabled && !fused) {
+    // In place when nothing runs after the LUT: the result is quantised to the input format on write anyway, and
+    // no second full size buffer is allocated. Cached pixels are read only.
+    bool inPlace = !sharpEnabled && input_buf.localpixels() != nullptr;
+    ImageBuf *dst = inPlace ? cur : target();
+    bool builtin = lut && lut->apply(*dst, *cur);
+    if (builtin || applyOCIO(*dst, *cur, lutPreset)) {
+      LOG(info) << "LUT preset " << settings.dLutPreset << " <" << lutPreset << "> "
+                << " applied" << (builtin ? " by the built-in engine" : "") << (inPlace ? " in place" : "")
+                << std::endl;
+      processing_entry->setStatus(ProcessingStatus::Graded);
+      advance(dst);
     } else {
-      LOG(error) << "LUT not applied: " << lut_buf.geterror() << std::endl;
-      lut_buf_ptr = &input_buf;
+      LOG(error) << "LUT not applied: " << dst->geterror() << std::endl;
+      if (dst != cur) {
+        drop(dst);
+      }
     }
-  } else {
+  } else if (!lutEnabled) {
     LOG(debug) << "LUT transformation disabled" << std::endl;
-    lut_buf_ptr = &input_buf;
   }
 
   // Apply denoise
   // Apply unsharp mask
 
-  if (settings.sharp_mode != -1) {
-    string_view kernel = settings.sharp_kerns[settings.sharp_kernel];
-    float width = settings.sharp_width;
-    float contrast = settings.sharp_contrast;
-    float threshold = settings.sharp_tresh;
-    if (ImageBufAlgo::unsharp_mask(*uns_buf_ptr, *lut_buf_ptr, kernel, width, contrast, threshold)) {
-      LOG(debug) << "Unsharp mask applied: <" << kernel.c_str() << ">" << std::endl;
+  if (sharpEnabled && !fused) {
+    ImageBuf *dst = target();
+    // Separable single pass for gaussian, box and binomial, OIIO's 2D convolution for the other kernels
+    bool separable = unsharpMask(*dst, *cur, kernel, width, contrast, threshold);
+    if (separable || ImageBufAlgo::unsharp_mask(*dst, *cur, kernel, width, contrast, threshold)) {
+      LOG(debug) << "Unsharp mask applied: <" << kernel.c_str() << ">" << (separable ? " separable" : "")
+                 << std::endl;
       processing_entry->setStatus(ProcessingStatus::Unsharped);
-      lut_buf_ptr->clear();
-      if (!processing_entry->rawCleared) {
-        processing_entry->raw_data->dcraw_clear_mem(raw_image);
-        processing_entry->rawCleared = true;
-      }
+      advance(dst);
     } else {
-      LOG(error) << "Unsharp mask not applied: " << uns_buf.geterror() << std::endl;
-      uns_buf_ptr = lut_buf_ptr;
+      LOG(error) << "Unsharp mask not applied: " << dst->geterror() << std::endl;
+      drop(dst);
     }
-  } else {
+  } else if (!sharpEnabled) {
     LOG(debug) << "Unsharp mask disabled" << std::endl;
-    uns_buf_ptr = lut_buf_ptr;
   }
 
-  // temp copy for saving
-  out_buf_ptr = uns_buf_ptr;
-
-  // if (!rawCleared) {
-  //     processing_entry->raw_data->dcraw_clear_mem(raw_image);
-  //     rawCleared = true;
-  // }
-
-  return {true, std::make_shared<ImageBuf>(*out_buf_ptr)};
-}
-/*
-bool unrawer_main(const std::string& inputFileName, const std::string& outputFileName,
-    ColorConfig* colorconfig, std::string* lut_preset,
-    QProgressBar* progressBar, MainWindow* mainWindow)
-{
-    Timer g_timer;
-//////////////////////////////////////////////////
-/// Image loading
-///
-    auto [load_ok, load_result] = img_load(inputFileName, progressBar, mainWindow);
-    //bool load_ok = thumb_load(input_buf, inputFileName, mainWindow);
-    if (!load_ok) {
-    LOG(error) << "Error reading " << inputFileName << std::endl;
-        mainWindow->emitUpdateTextSignal("Error! Check console for details");
-    return false;
+  // When the result is still input_buf it keeps wrapping the LibRaw image, released once the file is written
+  if (cur != &input_buf && mem[cur - scratch]) {
+    processing_entry->buffers.push_back(std::move(mem[cur - scratch]));
   }
-//////////////////////////////////////////////////
-/// Image processing
-///
-    auto [process_ok, out_buf] = imgProcessor(*load_result.first, colorconfig, lut_preset, progressBar, mainWindow);
-    if (!process_ok) {
-        LOG(error) << "Error processing " << inputFileName << std::endl;
-        mainWindow->emitUpdateTextSignal("Error! Check console for details");
-        return false;
-    }
-//////////////////////////////////////////////////
-/// Image saving
-///
-    bool write_ok = img_write(*out_buf, outputFileName, load_result.second, load_result.first->spec().format,
-progressBar, mainWindow); if (!write_ok) { LOG(error) << "Error writing " << outputFileName << std::endl;
-    mainWindow->emitUpdateTextSignal("Error! Check console for details");
-    return false;
-  }
-//////////////////////////////////////////////////
-
-    LOG(info) << "File processing time : " << g_timer.nowText() << std::endl;
-    pbar_color_rand(mainWindow);
-    QMetaObject::invokeMethod(progressBar, "setValue", Qt::QueuedConnection, Q_ARG(int, 0));
-
-    return true;
+  return {true, handOff(*cur, processing_entry)};
 }
-*/
\ No newline at end of file
@@ -0,0 +1,239 @@
+/*
+ * UnRAWer - camera raw batch processor on top of OpenImageIO
+ * Copyright (c) 2023 Erium Vladlen.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "unrawer/lut3d.hpp"
+#include "unrawer/parallel.hpp"
+#include "unrawer/simd.hpp"
+#include "unrawer/unsharp.hpp"
+
+bool unsharpSupported(const std::string &kernel) {
+  return kernel == "gaussian" || kernel == "box" || kernel == "binomial";
+}
+
+// Normalised 1D taps, the 2D kernel make_kernel() builds is their outer product
+static std::vector<float> makeTaps(const std::string &kernel, float width) {
+  int w = std::max(1, static_cast<int>(std::ceil(width))) | 1;
+  int r = w / 2;
+  std::vector<float> taps(w);
+  if (kernel == "binomial") {
+    taps[0] = 1.0f;
+    for (int i = 1; i < w; ++i) { // row w-1 of Pascal's triangle
+      for (int j = i; j > 0; --j) {
+        taps[j] += taps[j - 1];
+      }
+    }
+  } else {
+    for (int i = 0; i < w; ++i) {
+      float x = std::fabs(static_cast<float>(i - r));
+      if (kernel == "gaussian") {
+        x *= 2.0f / width;
+        taps[i] = x < 1.0f ? std::exp(-2.0f * x * x) : 0.0f;
+      } else { // box
+        taps[i] = x <= width * 0.5f ? 1.0f : 0.0f;
+      }
+    }
+  }
+  float sum = 0.0f;
+  for (float t : taps) {
+    sum += t;
+  }
+  for (float &t : taps) {
+    t /= sum;
+  }
+  return taps;
+}
+
+#if defined(UNRAWER_SIMD_X86)
+UNRAWER_TARGET_AVX2 static size_t axpyAVX2(float *out, const float *in, float w, size_t n) {
+  const __m256 vw = _mm256_set1_ps(w);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(out + i, _mm256_fmadd_ps(_mm256_loadu_ps(in + i), vw, _mm256_loadu_ps(out + i)));
+  }
+  return i;
+}
+#endif
+
+// out[i] += w * in[i]
+static void axpy(float *out, const float *in, float w, size_t n) {
+  size_t i = 0;
+#if defined(UNRAWER_SIMD_X86)
+  if (cpuHasAVX2()) {
+    i = axpyAVX2(out, in, w, n);
+  }
+  const __m128 vw = _mm_set1_ps(w);
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), _mm_mul_ps(_mm_loadu_ps(in + i), vw)));
+  }
+#elif defined(UNRAWER_SIMD_NEON)
+  const float32x4_t vw = vdupq_n_f32(w);
+  for (; i + 4 <= n; i += 4) {
+    vst1q_f32(out + i, vmlaq_f32(vld1q_f32(out + i), vld1q_f32(in + i), vw));
+  }
+#endif
+  for (; i < n; ++i) {
+    out[i] += w * in[i];
+  }
+}
+
+// uint16 samples are blurred in [0, 1] like OIIO does, float passes through
+template <class T> struct Sample;
+template <> struct Sample<uint16_t> {
+  static float load(uint16_t v) { return v * (1.0f / 65535.0f); }
+  static uint16_t store(float v) { return static_cast<uint16_t>(std::clamp(v, 0.0f, 1.0f) * 65535.0f + 0.5f); }
+};
+template <> struct Sample<float> {
+  static float load(float v) { return v; }
+  static float store(float v) { return v; }
+};
+
+// Ring rows of one tile with their halo stay within this, about half a typical L2
+static constexpr size_t kTileBytes = size_t(128) << 10;
+
+// Per-thread rows, kept between bands and images so steady state allocates nothing
+struct UnsharpScratch {
+  std::vector<float> ring;  // 2r+1 source rows of the tile and its r halo pixels per side, as float
+  std::vector<int> ringRow; // source row held by each ring slot, -1 empty
+  std::vector<float> vrow;  // vertically blurred tile row with its halo
+  std::vector<float> blur;  // blurred tile row
+};
+
+template <class T>
+static void unsharpRows(const OIIO::ImageBuf &src,
+                        OIIO::ImageBuf &dst,
+                        const std::vector<float> &taps,
+                        const Lut3D *lut,
+                        float contrast,
+                        float threshold,
+                        int ybegin,
+                        int yend) {
+  static thread_local UnsharpScratch scratch;
+  const OIIO::ImageSpec &spec = src.spec();
+  const int taps_n = static_cast<int>(taps.size()), r = taps_n / 2;
+  const size_t nch = static_cast<size_t>(spec.nchannels), width = static_cast<size_t>(spec.width);
+  const int y0 = spec.y, y1 = spec.y + spec.height;
+
+  // Columns are processed in tiles so the ring stays in cache however wide the image is, the halo columns are
+  // converted (and graded) once more for the neighbouring tile
+  const size_t pixelBytes = static_cast<size_t>(taps_n) * nch * sizeof(float);
+  const size_t tile = std::min(width, std::max<size_t>(64, kTileBytes / pixelBytes));
+  const size_t extMax = tile + 2 * static_cast<size_t>(r);
+  scratch.ring.resize(extMax * nch * taps_n);
+  scratch.vrow.resize(extMax * nch);
+  scratch.blur.resize(tile * nch);
+
+  for (size_t x0 = 0; x0 < width; x0 += tile) {
+    const size_t tw = std::min(tile, width - x0), ext = tw + 2 * static_cast<size_t>(r);
+    const size_t row = tw * nch, extRow = ext * nch;
+    scratch.ringRow.assign(taps_n, -1);
+
+    // Source row y of the tile and its halo as float, border pixels repeated, converted and graded once for all
+    // the output rows that need it
+    auto source = [&](int y) -> const float * {
+      y = std::clamp(y, y0, y1 - 1);
+      size_t slot = static_cast<size_t>(y - y0) % taps_n;
+      float *ringRow = scratch.ring.data() + slot * extRow;
+      if (scratch.ringRow[slot] != y) {
+        const T *in = static_cast<const T *>(src.pixeladdr(spec.x, y, spec.z));
+        float *o = ringRow;
+        for (size_t i = 0; i < ext; ++i) {
+          ptrdiff_t x = static_cast<ptrdiff_t>(x0 + i) - r;
+          const T *p = in + std::clamp<ptrdiff_t>(x, 0, static_cast<ptrdiff_t>(width) - 1) * nch;
+          for (size_t c = 0; c < nch; ++c) {
+            *o++ = Sample<T>::load(p[c]);
+          }
+        }
+        if (lut) {
+          lut->applyFloat(ringRow, ext, spec.nchannels);
+          if (std::is_integral<T>::value) {
+            // Same values as grading into a uint16 buffer first
+            for (size_t i = 0; i < extRow; ++i) {
+              ringRow[i] = std::clamp(ringRow[i], 0.0f, 1.0f);
+            }
+          }
+        }
+        scratch.ringRow[slot] = y;
+      }
+      return ringRow;
+    };
+
+    for (int y = ybegin; y < yend; ++y) {
+      // Vertical, over the halo too
+      float *vrow = scratch.vrow.data();
+      std::fill(vrow, vrow + extRow, 0.0f);
+      for (int k = 0; k < taps_n; ++k) {
+        axpy(vrow, source(y + k - r), taps[k], extRow);
+      }
+
+      // Horizontal, tap k of pixel i is r-k pixels to its left
+      float *blur = scratch.blur.data();
+      std::fill(blur, blur + row, 0.0f);
+      for (int k = 0; k < taps_n; ++k) {
+        axpy(blur, vrow + k * nch, taps[k], row);
+      }
+
+      // Difference, threshold and add in the store, straight into the output format
+      const float *s = source(y) + r * nch;
+      T *out = static_cast<T *>(dst.pixeladdr(spec.x, y, spec.z)) + x0 * nch;
+      for (size_t i = 0; i < row; ++i) {
+        float d = s[i] - blur[i];
+        d = std::fabs(d) < threshold ? 0.0f : d;
+        out[i] = Sample<T>::store(s[i] + contrast * d);
+      }
+    }
+  }
+}
+
+bool unsharpMask(OIIO::ImageBuf &dst,
+                 const OIIO::ImageBuf &src,
+                 const std::string &kernel,
+                 float width,
+                 float contrast,
+                 float threshold,
+                 const Lut3D *lut) {
+  const OIIO::ImageSpec &spec = src.spec();
+  bool uint16 = spec.format == OIIO::TypeDesc::UINT16;
+  if (!unsharpSupported(kernel) || &dst == &src || src.localpixels() == nullptr ||
+      (!uint16 && spec.format != OIIO::TypeDesc::FLOAT) || spec.depth > 1 || (lut && spec.nchannels < 3)) {
+    return false;
+  }
+  if (!dst.initialized()) {
+    dst.reset(spec);
+  }
+  const OIIO::ImageSpec &dspec = dst.spec();
+  if (dst.localpixels() == nullptr || dspec.format != spec.format || dspec.nchannels != spec.nchannels ||
+      dspec.width != spec.width || dspec.height != spec.height) {
+    return false;
+  }
+
+  std::vector<float> taps = makeTaps(kernel, width);
+  parallelRows(src.roi(), [&](OIIO::ROI roi) {
+    if (uint16) {
+      unsharpRows<uint16_t>(src, dst, taps, lut, contrast, threshold, roi.ybegin, roi.yend);
+    } else {
+      unsharpRows<float>(src, dst, taps, lut, contrast, threshold, roi.ybegin, roi.yend);
+    }
+  });
+  return true;
+}